@@ -1,12 +1,19 @@
 #include <iostream>
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
 #include <random>
-#include <thread> 
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
 #include "thread_pool.h"
-
-std::random_device rd;  // a seed source for the random number engine
-std::mt19937 gen(rd()); // mersenne_twister_engine seeded with rd()
-std::uniform_int_distribution<> distrib(5000, 10000);
+#if !defined(_WIN32)
+#include <sys/resource.h>
+#endif
 
 /*
 1.    4-      
@@ -18,36 +25,337 @@ std::uniform_int_distribution<> distrib(5000, 10000);
    5  10 .
 */
 
-size_t task() {
-    size_t time = distrib(gen);
-    std::this_thread::sleep_for(std::chrono::milliseconds(time));
-    return time;
-}
+// Load generator for sizing the pool. Every combination of --workers and
+// --modes gets a fresh pool, driven for --duration seconds and then drained,
+// and prints one row:
+//   tasks/s   completed tasks per second of wall time, drain included
+//   wait      p50/p99/p99.9 queue wait, from the pool's own metrics
+//   busy      share of worker time spent inside tasks
+//   pcpu      CPU time of the whole process, client and timer threads
+//             included, over workers x wall time; not a worker utilization,
+//             and it can pass busy. Sleep-bound tasks keep a worker busy
+//             without using its CPU
+//
+// --arrival=open submits Poisson arrivals at --rate tasks per second on
+// schedule, whether or not earlier tasks have finished, so an overloaded
+// pool shows up as growing queue wait. --arrival=closed runs --clients
+// threads that each submit a task, wait for it and think for --think-us.
+// Task durations are exponential with mean --cpu-us for CPU-bound (spinning)
+// tasks and --sleep-us for sleep-bound ones; --cpu-share is the fraction of
+// CPU-bound tasks. --trace=file replays recorded tasks instead, cycling
+// through the file, one per line as "<microseconds> [cpu|sleep]".
+
+struct load_config
+{
+    std::vector<size_t> workers;
+    std::vector<scheduler_mode> modes{ scheduler_mode::global_queue, scheduler_mode::work_stealing };
+    bool open_loop = true;
+    double rate = 2000.0;
+    size_t clients = 8;
+    double think_us = 0.0;
+    double duration_s = 2.0;
+    double cpu_share = 0.5;
+    double cpu_us = 100.0;
+    double sleep_us = 1000.0;
+    std::string trace_path;
+};
+
+struct task_spec
+{
+    std::chrono::microseconds duration;
+    bool cpu_bound;
+};
 
-int main()
+// Where the submitters take their tasks from. The trace cursor is shared, so
+// concurrent clients together replay the trace in order.
+struct workload
 {
-    int task_count = 10;
+    const load_config& config;
+    std::vector<task_spec> trace;
+    std::atomic<size_t> cursor = 0;
+
+    explicit workload(const load_config& settings) : config(settings) {}
+
+    task_spec next(std::mt19937& random) {
+        if (!trace.empty()) {
+            return trace[cursor.fetch_add(1, std::memory_order_relaxed) % trace.size()];
+        }
+        bool cpu_bound = std::bernoulli_distribution(config.cpu_share)(random);
+        double mean = cpu_bound ? config.cpu_us : config.sleep_us;
+        double micros = mean > 0.0 ? std::exponential_distribution<>(1.0 / mean)(random) : 0.0;
+        return task_spec{ std::chrono::microseconds(static_cast<long long>(micros)), cpu_bound };
+    }
+};
+
+struct run_result
+{
+    double seconds = 0.0;
+    double cpu_seconds = 0.0;
+    pool_stats stats;
+};
+
+size_t run_spec(const task_spec spec) {
+    if (spec.cpu_bound) {
+        auto until = std::chrono::steady_clock::now() + spec.duration;
+        while (std::chrono::steady_clock::now() < until) {
+            cpu_relax();
+        }
+    }
+    else {
+        std::this_thread::sleep_for(spec.duration);
+    }
+    return static_cast<size_t>(spec.duration.count());
+}
+
+double process_cpu_seconds() {
+#if defined(_WIN32)
+    FILETIME created, exited, kernel, user;
+    GetProcessTimes(GetCurrentProcess(), &created, &exited, &kernel, &user);
+    auto seconds = [](const FILETIME& time) { return double((uint64_t(time.dwHighDateTime) << 32) | time.dwLowDateTime) * 1e-7; };
+    return seconds(kernel) + seconds(user);
+#else
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    return double(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) + double(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1e-6;
+#endif
+}
+
+// Lines that do not start with a number, such as blank lines or comments,
+// are skipped.
+bool load_trace(const std::string& path, std::vector<task_spec>& trace) {
+    std::ifstream input(path);
+    std::string line;
+    while (std::getline(input, line)) {
+        std::istringstream fields(line);
+        double micros = 0.0;
+        std::string kind = "cpu";
+        if (!(fields >> micros) || micros < 0.0) {
+            continue;
+        }
+        fields >> kind;
+        trace.push_back(task_spec{ std::chrono::microseconds(static_cast<long long>(micros)), kind != "sleep" });
+    }
+    return !trace.empty();
+}
+
+// A submit that falls behind schedule does not sleep until it has caught up,
+// so late arrivals bunch up as they would in real traffic.
+void drive_open_loop(thread_pool& pool, workload& load, const std::chrono::steady_clock::time_point end) {
+    std::mt19937 random(std::random_device{}());
+    std::exponential_distribution<> gap(load.config.rate);
+    auto due = std::chrono::steady_clock::now();
+    while (due < end) {
+        std::this_thread::sleep_until(due);
+        task_spec spec = load.next(random);
+        pool.add_task([spec] { return run_spec(spec); });
+        due += std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(gap(random)));
+    }
+}
+
+void drive_closed_loop(thread_pool& pool, workload& load, const std::chrono::steady_clock::time_point end) {
+    std::random_device seed;
+    std::vector<std::thread> clients;
+    for (size_t client = 0; client < load.config.clients; client++) {
+        clients.emplace_back([&pool, &load, end, client_seed = seed()] {
+            std::mt19937 random(client_seed);
+            std::exponential_distribution<> think(load.config.think_us > 0.0 ? 1.0 / load.config.think_us : 1.0);
+            while (std::chrono::steady_clock::now() < end) {
+                task_spec spec = load.next(random);
+                pool.submit([spec] { return run_spec(spec); }).get();
+                if (load.config.think_us > 0.0) {
+                    std::this_thread::sleep_for(std::chrono::microseconds(static_cast<long long>(think(random))));
+                }
+            }
+        });
+    }
+    for (std::thread& client : clients) {
+        client.join();
+    }
+}
+
+run_result run_load(workload& load, const size_t workers, const scheduler_mode mode) {
+    pool_config settings;
+    settings.worker_count = workers;
+    settings.mode = mode;
+    settings.collect_metrics = true;
     thread_pool pool;
-    pool.initialize(4, true);
-    //std::cout << "Starting " << task_count << " tasks." << std::endl;
-    for (int i = 0; i < task_count; i++) {
-        size_t id = pool.add_task(task);
-        //std::cout << "Added task " << id << " to the thread pool." << std::endl;
-    }
-    std::this_thread::sleep_for(std::chrono::seconds(8));
-    pool.terminate_now();
-    /*
-    while(true) {
-        size_t id;
-        std::cout << std::endl << "Enter task ID to check status: ";
-        std::cin >> id;
-        if (id == -1) {
-            break;
-        }
-        size_t status = pool.get_status(id);
-        if (status != 0) {
-            std::cout << "Result: " << status << std::endl;
-        }
-    }
-    */
-}
\ No newline at end of file
+    pool.initialize(settings);
+    run_result result;
+    double cpu_before = process_cpu_seconds();
+    auto started = std::chrono::steady_clock::now();
+    auto end = started + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(load.config.duration_s));
+    if (load.config.open_loop) {
+        drive_open_loop(pool, load, end);
+    }
+    else {
+        drive_closed_loop(pool, load, end);
+    }
+    // Runs whatever is still queued before returning.
+    pool.terminate();
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    result.cpu_seconds = process_cpu_seconds() - cpu_before;
+    result.stats = pool.stats();
+    return result;
+}
+
+void print_row(const scheduler_mode mode, const size_t workers, const run_result& result) {
+    const pool_stats& stats = result.stats;
+    double worker_seconds = result.seconds * double(workers);
+    printf("%-13s %7zu %9zu %11.0f %9.3f %9.3f %9.3f %6.1f %6.1f\n",
+        mode == scheduler_mode::global_queue ? "global_queue" : "work_stealing",
+        workers,
+        (size_t)stats.tasks_executed,
+        double(stats.tasks_executed) / result.seconds,
+        stats.queue_wait.percentile(50) * 1e-6,
+        stats.queue_wait.percentile(99) * 1e-6,
+        stats.queue_wait.percentile(99.9) * 1e-6,
+        100.0 * double(stats.execution.sum) * 1e-9 / worker_seconds,
+        100.0 * result.cpu_seconds / worker_seconds);
+}
+
+void print_usage() {
+    std::cout << "Usage: Lab2 [options]\n"
+        << "  --workers=1,2,4       worker counts to try (default: powers of two up to the core count)\n"
+        << "  --modes=global,stealing\n"
+        << "                        scheduler modes to try (default: both)\n"
+        << "  --arrival=open|closed open-loop Poisson arrivals or closed-loop clients (default: open)\n"
+        << "  --rate=N              open loop: arrivals per second (default: 2000)\n"
+        << "  --clients=N           closed loop: client threads (default: 8)\n"
+        << "  --think-us=N          closed loop: mean think time between tasks (default: 0)\n"
+        << "  --duration=S          seconds of load per run (default: 2)\n"
+        << "  --cpu-share=F         fraction of CPU-bound tasks (default: 0.5)\n"
+        << "  --cpu-us=N            mean duration of a CPU-bound task (default: 100)\n"
+        << "  --sleep-us=N          mean duration of a sleep-bound task (default: 1000)\n"
+        << "  --trace=FILE          replay \"<microseconds> [cpu|sleep]\" lines instead\n";
+}
+
+std::vector<std::string> split_list(const std::string& value) {
+    std::vector<std::string> items;
+    std::istringstream input(value);
+    std::string item;
+    while (std::getline(input, item, ',')) {
+        if (!item.empty()) {
+            items.push_back(item);
+        }
+    }
+    return items;
+}
+
+bool parse_option(const std::string& key, const std::string& value, load_config& config) {
+    if (key == "--workers") {
+        config.workers.clear();
+        for (const std::string& item : split_list(value)) {
+            config.workers.push_back(std::max<size_t>(std::stoul(item), 1));
+        }
+        return !config.workers.empty();
+    }
+    if (key == "--modes") {
+        config.modes.clear();
+        for (const std::string& item : split_list(value)) {
+            if (item == "global" || item == "global_queue") {
+                config.modes.push_back(scheduler_mode::global_queue);
+            }
+            else if (item == "stealing" || item == "work_stealing") {
+                config.modes.push_back(scheduler_mode::work_stealing);
+            }
+            else {
+                return false;
+            }
+        }
+        return !config.modes.empty();
+    }
+    if (key == "--arrival") {
+        config.open_loop = value == "open";
+        return value == "open" || value == "closed";
+    }
+    if (key == "--rate") {
+        config.rate = std::stod(value);
+        return config.rate > 0.0;
+    }
+    if (key == "--clients") {
+        config.clients = std::stoul(value);
+        return config.clients > 0;
+    }
+    if (key == "--think-us") {
+        config.think_us = std::stod(value);
+        return config.think_us >= 0.0;
+    }
+    if (key == "--duration") {
+        config.duration_s = std::stod(value);
+        return config.duration_s > 0.0;
+    }
+    if (key == "--cpu-share") {
+        config.cpu_share = std::stod(value);
+        return config.cpu_share >= 0.0 && config.cpu_share <= 1.0;
+    }
+    if (key == "--cpu-us") {
+        config.cpu_us = std::stod(value);
+        return config.cpu_us >= 0.0;
+    }
+    if (key == "--sleep-us") {
+        config.sleep_us = std::stod(value);
+        return config.sleep_us >= 0.0;
+    }
+    if (key == "--trace") {
+        config.trace_path = value;
+        return !value.empty();
+    }
+    return false;
+}
+
+int main(int argc, char** argv)
+{
+    load_config config;
+    for (int index = 1; index < argc; index++) {
+        std::string argument = argv[index];
+        size_t equals = argument.find('=');
+        std::string key = argument.substr(0, equals);
+        std::string value = equals == std::string::npos ? "" : argument.substr(equals + 1);
+        if (key == "--help") {
+            print_usage();
+            return 0;
+        }
+        bool valid = false;
+        try {
+            valid = parse_option(key, value, config);
+        }
+        catch (const std::exception&) {
+        }
+        if (!valid) {
+            std::cout << "Invalid option: " << argument << std::endl;
+            print_usage();
+            return 1;
+        }
+    }
+    if (config.workers.empty()) {
+        size_t hardware = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+        for (size_t workers = 1; workers < hardware; workers *= 2) {
+            config.workers.push_back(workers);
+        }
+        config.workers.push_back(hardware);
+    }
+    workload load(config);
+    if (!config.trace_path.empty() && !load_trace(config.trace_path, load.trace)) {
+        std::cout << "Could not read any tasks from " << config.trace_path << "." << std::endl;
+        return 1;
+    }
+
+    if (config.open_loop) {
+        printf("Open loop, %.0f tasks/s for %.1f s", config.rate, config.duration_s);
+    }
+    else {
+        printf("Closed loop, %zu clients, %.0f us think time, for %.1f s", config.clients, config.think_us, config.duration_s);
+    }
+    if (!load.trace.empty()) {
+        printf(", replaying %zu tasks from %s.\n\n", load.trace.size(), config.trace_path.c_str());
+    }
+    else {
+        printf(", %.0f%% CPU-bound tasks of %.0f us, the rest sleeping %.0f us on average.\n\n", config.cpu_share * 100.0, config.cpu_us, config.sleep_us);
+    }
+    printf("%-13s %7s %9s %11s %9s %9s %9s %6s %6s\n", "mode", "workers", "tasks", "tasks/s", "p50 ms", "p99 ms", "p99.9 ms", "busy%", "pcpu%");
+    for (scheduler_mode mode : config.modes) {
+        for (size_t workers : config.workers) {
+            print_row(mode, workers, run_load(load, workers, mode));
+        }
+    }
+}
@@ -0,0 +1,343 @@
+#include <benchmark/benchmark.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "thread_pool.h"
+
+// Pool scenarios are instantiated once per scheduler mode and shared queue
+// backend, queue scenarios once per task_queue backend. Worker counts are the
+// benchmark argument.
+
+static void wait_until(const std::atomic<size_t>& counter, const size_t target)
+{
+    while (counter.load(std::memory_order_acquire) < target)
+    {
+        std::this_thread::yield();
+    }
+}
+
+static void busy_for(const std::chrono::nanoseconds duration)
+{
+    auto until = std::chrono::steady_clock::now() + duration;
+    while (std::chrono::steady_clock::now() < until)
+    {
+        cpu_relax();
+    }
+}
+
+static void worker_counts(benchmark::internal::Benchmark* benchmark)
+{
+    size_t hardware = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+    for (size_t workers = 1; workers < hardware; workers *= 2)
+    {
+        benchmark->Arg(static_cast<int64_t>(workers));
+    }
+    benchmark->Arg(static_cast<int64_t>(hardware));
+}
+
+// default_pool_policy covers priority_levels<task_priority_count>.
+struct locked_queue_policy : default_pool_policy
+{
+    using queue_backend = unbounded_locked;
+};
+
+struct lockfree_queue_policy : default_pool_policy
+{
+    using queue_backend = bounded_lockfree<1024>;
+};
+
+template <typename policy_t>
+static void start_pool(basic_thread_pool<policy_t>& pool, const benchmark::State& state, const scheduler_mode mode)
+{
+    pool_config config;
+    config.worker_count = static_cast<size_t>(state.range(0));
+    config.mode = mode;
+    pool.initialize(config);
+}
+
+// Submit-to-completion rate of tasks that do nothing.
+template <typename policy_t, scheduler_mode mode>
+static void BM_EmptyTaskThroughput(benchmark::State& state)
+{
+    const size_t batch = 10000;
+    basic_thread_pool<policy_t> pool;
+    start_pool(pool, state, mode);
+    std::atomic<size_t> done = 0;
+    size_t submitted = 0;
+    for (auto _ : state)
+    {
+        for (size_t index = 0; index < batch; index++)
+        {
+            pool.add_task([&done] { done.fetch_add(1, std::memory_order_release); return size_t(0); });
+        }
+        submitted += batch;
+        wait_until(done, submitted);
+    }
+    pool.terminate();
+    state.SetItemsProcessed(static_cast<int64_t>(submitted));
+}
+BENCHMARK_TEMPLATE(BM_EmptyTaskThroughput, default_pool_policy, scheduler_mode::global_queue)->Apply(worker_counts)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_EmptyTaskThroughput, locked_queue_policy, scheduler_mode::global_queue)->Apply(worker_counts)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_EmptyTaskThroughput, lockfree_queue_policy, scheduler_mode::global_queue)->Apply(worker_counts)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_EmptyTaskThroughput, default_pool_policy, scheduler_mode::work_stealing)->Apply(worker_counts)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_EmptyTaskThroughput, locked_queue_policy, scheduler_mode::work_stealing)->Apply(worker_counts)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_EmptyTaskThroughput, lockfree_queue_policy, scheduler_mode::work_stealing)->Apply(worker_counts)->UseRealTime();
+
+// Per-task cost of the dequeue path alone: a gate task holds the only worker
+// while the batch is queued, so the timed part is the worker popping and
+// running empty tasks back to back. Reported as ns_per_task, side by side per
+// backend. The batch fits the bounded backend, which would otherwise make the
+// submitting thread wait on the gated worker.
+template <typename policy_t, scheduler_mode mode>
+static void BM_DequeueOverhead(benchmark::State& state)
+{
+    const size_t batch = 1000;
+    basic_thread_pool<policy_t> pool;
+    start_pool(pool, state, mode);
+    std::atomic<size_t> done = 0;
+    size_t submitted = 0;
+    double total_seconds = 0.0;
+    for (auto _ : state)
+    {
+        std::atomic<bool> open = false;
+        std::chrono::steady_clock::time_point opened_at;
+        pool.add_task([&open, &opened_at] {
+            while (!open.load(std::memory_order_acquire))
+            {
+                std::this_thread::yield();
+            }
+            opened_at = std::chrono::steady_clock::now();
+            return size_t(0);
+        });
+        for (size_t index = 0; index < batch; index++)
+        {
+            pool.add_task([&done] { done.fetch_add(1, std::memory_order_release); return size_t(0); });
+        }
+        open.store(true, std::memory_order_release);
+        submitted += batch;
+        wait_until(done, submitted);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - opened_at).count();
+        state.SetIterationTime(seconds);
+        total_seconds += seconds;
+    }
+    pool.terminate();
+    state.SetItemsProcessed(static_cast<int64_t>(submitted));
+    state.counters["ns_per_task"] = submitted > 0 ? total_seconds * 1e9 / static_cast<double>(submitted) : 0.0;
+}
+BENCHMARK_TEMPLATE(BM_DequeueOverhead, default_pool_policy, scheduler_mode::global_queue)->Arg(1)->UseManualTime();
+BENCHMARK_TEMPLATE(BM_DequeueOverhead, locked_queue_policy, scheduler_mode::global_queue)->Arg(1)->UseManualTime();
+BENCHMARK_TEMPLATE(BM_DequeueOverhead, lockfree_queue_policy, scheduler_mode::global_queue)->Arg(1)->UseManualTime();
+BENCHMARK_TEMPLATE(BM_DequeueOverhead, default_pool_policy, scheduler_mode::work_stealing)->Arg(1)->UseManualTime();
+BENCHMARK_TEMPLATE(BM_DequeueOverhead, locked_queue_policy, scheduler_mode::work_stealing)->Arg(1)->UseManualTime();
+BENCHMARK_TEMPLATE(BM_DequeueOverhead, lockfree_queue_policy, scheduler_mode::work_stealing)->Arg(1)->UseManualTime();
+
+// A task waiting on a future that the next task in its batch completes: the
+// waiting worker has to find that task on its own deque. One worker, so a
+// batch the waiter cannot reach would hang here.
+template <scheduler_mode mode>
+static void BM_BatchedNestedWait(benchmark::State& state)
+{
+    thread_pool pool;
+    pool.set_batch_dequeue(8);
+    start_pool(pool, state, mode);
+    std::atomic<size_t> done = 0;
+    size_t submitted = 0;
+    for (auto _ : state)
+    {
+        std::atomic<bool> open = false;
+        pool.add_task([&open] {
+            while (!open.load(std::memory_order_acquire))
+            {
+                std::this_thread::yield();
+            }
+            return size_t(0);
+        });
+        task_promise<void> promise;
+        task_future<void> future = promise.get_future();
+        pool.add_task([&pool, &done, future] {
+            pool.wait(future);
+            done.fetch_add(1, std::memory_order_release);
+            return size_t(0);
+        });
+        pool.add_task([&done, promise = std::move(promise)]() mutable {
+            promise.set_value();
+            done.fetch_add(1, std::memory_order_release);
+            return size_t(0);
+        });
+        open.store(true, std::memory_order_release);
+        submitted += 2;
+        wait_until(done, submitted);
+    }
+    pool.terminate();
+    state.SetItemsProcessed(static_cast<int64_t>(submitted));
+}
+BENCHMARK_TEMPLATE(BM_BatchedNestedWait, scheduler_mode::global_queue)->Arg(1)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_BatchedNestedWait, scheduler_mode::work_stealing)->Arg(1)->UseRealTime();
+
+// Empty-task throughput with the policy's debug, metrics, tracing and status
+// paths compiled in or out.
+template <typename policy_t>
+static void BM_PolicyOverhead(benchmark::State& state)
+{
+    const size_t batch = 10000;
+    basic_thread_pool<policy_t> pool;
+    start_pool(pool, state, scheduler_mode::global_queue);
+    std::atomic<size_t> done = 0;
+    size_t submitted = 0;
+    for (auto _ : state)
+    {
+        for (size_t index = 0; index < batch; index++)
+        {
+            pool.add_task([&done] { done.fetch_add(1, std::memory_order_release); return size_t(0); });
+        }
+        submitted += batch;
+        wait_until(done, submitted);
+    }
+    pool.terminate();
+    state.SetItemsProcessed(static_cast<int64_t>(submitted));
+}
+BENCHMARK_TEMPLATE(BM_PolicyOverhead, default_pool_policy)->Apply(worker_counts)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_PolicyOverhead, production_pool_policy)->Apply(worker_counts)->UseRealTime();
+
+// Cost of one add_task() call on the submitting thread while workers drain.
+template <typename policy_t, scheduler_mode mode>
+static void BM_SubmitLatency(benchmark::State& state)
+{
+    basic_thread_pool<policy_t> pool;
+    start_pool(pool, state, mode);
+    std::atomic<size_t> done = 0;
+    size_t submitted = 0;
+    for (auto _ : state)
+    {
+        pool.add_task([&done] { done.fetch_add(1, std::memory_order_release); return size_t(0); });
+        submitted++;
+    }
+    wait_until(done, submitted);
+    pool.terminate();
+}
+BENCHMARK_TEMPLATE(BM_SubmitLatency, default_pool_policy, scheduler_mode::global_queue)->Apply(worker_counts)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_SubmitLatency, locked_queue_policy, scheduler_mode::global_queue)->Apply(worker_counts)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_SubmitLatency, lockfree_queue_policy, scheduler_mode::global_queue)->Apply(worker_counts)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_SubmitLatency, default_pool_policy, scheduler_mode::work_stealing)->Apply(worker_counts)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_SubmitLatency, locked_queue_policy, scheduler_mode::work_stealing)->Apply(worker_counts)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_SubmitLatency, lockfree_queue_policy, scheduler_mode::work_stealing)->Apply(worker_counts)->UseRealTime();
+
+// Time from add_task() on an idle pool to the task starting on a parked worker.
+template <typename policy_t, scheduler_mode mode>
+static void BM_WakeupLatency(benchmark::State& state)
+{
+    basic_thread_pool<policy_t> pool;
+    start_pool(pool, state, mode);
+    std::atomic<size_t> done = 0;
+    size_t submitted = 0;
+    for (auto _ : state)
+    {
+        std::chrono::steady_clock::time_point started_at;
+        auto submitted_at = std::chrono::steady_clock::now();
+        pool.add_task([&done, &started_at] {
+            started_at = std::chrono::steady_clock::now();
+            done.fetch_add(1, std::memory_order_release);
+            return size_t(0);
+        });
+        wait_until(done, ++submitted);
+        state.SetIterationTime(std::chrono::duration<double>(started_at - submitted_at).count());
+        // Give the worker time to park again.
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+    pool.terminate();
+}
+BENCHMARK_TEMPLATE(BM_WakeupLatency, default_pool_policy, scheduler_mode::global_queue)->Apply(worker_counts)->UseManualTime();
+BENCHMARK_TEMPLATE(BM_WakeupLatency, locked_queue_policy, scheduler_mode::global_queue)->Apply(worker_counts)->UseManualTime();
+BENCHMARK_TEMPLATE(BM_WakeupLatency, lockfree_queue_policy, scheduler_mode::global_queue)->Apply(worker_counts)->UseManualTime();
+BENCHMARK_TEMPLATE(BM_WakeupLatency, default_pool_policy, scheduler_mode::work_stealing)->Apply(worker_counts)->UseManualTime();
+BENCHMARK_TEMPLATE(BM_WakeupLatency, locked_queue_policy, scheduler_mode::work_stealing)->Apply(worker_counts)->UseManualTime();
+BENCHMARK_TEMPLATE(BM_WakeupLatency, lockfree_queue_policy, scheduler_mode::work_stealing)->Apply(worker_counts)->UseManualTime();
+
+// 1000 tasks, one in ten running 200 us and the rest 2 us; reports makespan
+// and the pool's own p99 queue wait.
+template <typename policy_t, scheduler_mode mode>
+static void BM_MixedWorkload(benchmark::State& state)
+{
+    const size_t batch = 1000;
+    basic_thread_pool<policy_t> pool;
+    start_pool(pool, state, mode);
+    std::atomic<size_t> done = 0;
+    size_t submitted = 0;
+    for (auto _ : state)
+    {
+        for (size_t index = 0; index < batch; index++)
+        {
+            std::chrono::nanoseconds duration = index % 10 == 0 ? std::chrono::microseconds(200) : std::chrono::microseconds(2);
+            pool.add_task([&done, duration] {
+                busy_for(duration);
+                done.fetch_add(1, std::memory_order_release);
+                return size_t(0);
+            });
+        }
+        submitted += batch;
+        wait_until(done, submitted);
+    }
+    pool_stats stats = pool.stats();
+    pool.terminate();
+    state.SetItemsProcessed(static_cast<int64_t>(submitted));
+    state.counters["p99_wait_us"] = stats.queue_wait.percentile(99) * 1e-3;
+}
+BENCHMARK_TEMPLATE(BM_MixedWorkload, default_pool_policy, scheduler_mode::global_queue)->Apply(worker_counts)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_MixedWorkload, locked_queue_policy, scheduler_mode::global_queue)->Apply(worker_counts)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_MixedWorkload, lockfree_queue_policy, scheduler_mode::global_queue)->Apply(worker_counts)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_MixedWorkload, default_pool_policy, scheduler_mode::work_stealing)->Apply(worker_counts)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_MixedWorkload, locked_queue_policy, scheduler_mode::work_stealing)->Apply(worker_counts)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_MixedWorkload, lockfree_queue_policy, scheduler_mode::work_stealing)->Apply(worker_counts)->UseRealTime();
+
+// Each benchmark thread bumps its own counter, either packed next to the
+// others' or on a cache line of its own as the pool lays out its hot state.
+// The gap between the two grows with the thread count on a multi-core
+// machine; with one thread it is the baseline cost of the increment.
+struct packed_counter
+{
+    std::atomic<uint64_t> value = 0;
+};
+
+struct alignas(cache_line_size) isolated_counter
+{
+    std::atomic<uint64_t> value = 0;
+};
+
+template <typename counter_t>
+static void BM_FalseSharing(benchmark::State& state)
+{
+    static counter_t counters[64];
+    std::atomic<uint64_t>& mine = counters[state.thread_index() % 64].value;
+    for (auto _ : state)
+    {
+        mine.fetch_add(1, std::memory_order_relaxed);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK_TEMPLATE(BM_FalseSharing, packed_counter)->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_FalseSharing, isolated_counter)->ThreadRange(1, 8)->UseRealTime();
+
+// Each benchmark thread pushes one element and pops one, against one queue
+// shared by all threads.
+template <typename backend_t>
+static void BM_QueuePushPop(benchmark::State& state)
+{
+    static task_queue<size_t, backend_t> queue;
+    size_t value = 0;
+    size_t id = 0;
+    for (auto _ : state)
+    {
+        queue.emplace(value);
+        while (!queue.pop(value, id))
+        {
+            std::this_thread::yield();
+        }
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK_TEMPLATE(BM_QueuePushPop, unbounded_locked)->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_QueuePushPop, bounded_lockfree<1024>)->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_QueuePushPop, priority_levels<task_priority_count>)->ThreadRange(1, 8)->UseRealTime();
+
+BENCHMARK_MAIN();
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+
+// Alignment that keeps independently written objects off each other's cache
+// lines. GCC warns about std::hardware_destructive_interference_size in headers
+// because its value follows -mtune and would silently change the layout of
+// every type built on it, so there it is pinned to the 64 bytes of current x86
+// and most ARM cores.
+#if defined(__cpp_lib_hardware_interference_size) && !defined(__GNUC__)
+inline constexpr size_t cache_line_size = std::hardware_destructive_interference_size;
+#else
+inline constexpr size_t cache_line_size = 64;
+#endif
@@ -0,0 +1,184 @@
+#pragma once
+
+#include <algorithm>
+#include <string>
+#include <thread>
+#include <vector>
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#elif defined(__linux__)
+#include <fstream>
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// Logical CPUs are numbered group * 64 + index on Windows and by kernel CPU
+// id on Linux. Elsewhere there is one node and pinning is a no-op.
+struct numa_node
+{
+	std::vector<size_t> cpus;
+};
+
+inline std::vector<numa_node> detect_numa_nodes();
+inline bool pin_current_thread(const std::vector<size_t>& cpus);
+inline size_t current_cpu();
+
+inline std::vector<numa_node> single_node_topology()
+{
+	std::vector<numa_node> nodes(1);
+	size_t cpu_count = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+	for (size_t cpu = 0; cpu < cpu_count; cpu++)
+	{
+		nodes[0].cpus.push_back(cpu);
+	}
+	return nodes;
+}
+
+#if defined(_WIN32)
+
+std::vector<numa_node> detect_numa_nodes()
+{
+	std::vector<numa_node> nodes;
+	ULONG highest = 0;
+	if (!GetNumaHighestNodeNumber(&highest))
+	{
+		return single_node_topology();
+	}
+	for (USHORT node = 0; node <= highest; node++)
+	{
+		GROUP_AFFINITY affinity = {};
+		if (!GetNumaNodeProcessorMaskEx(node, &affinity) || affinity.Mask == 0)
+		{
+			continue;
+		}
+		numa_node current;
+		for (size_t bit = 0; bit < 64; bit++)
+		{
+			if (affinity.Mask & (KAFFINITY(1) << bit))
+			{
+				current.cpus.push_back(affinity.Group * 64 + bit);
+			}
+		}
+		nodes.push_back(current);
+	}
+	return nodes.empty() ? single_node_topology() : nodes;
+}
+
+// All cpus must belong to the same processor group as the first one.
+bool pin_current_thread(const std::vector<size_t>& cpus)
+{
+	if (cpus.empty())
+	{
+		return false;
+	}
+	GROUP_AFFINITY affinity = {};
+	affinity.Group = static_cast<WORD>(cpus[0] / 64);
+	for (size_t cpu : cpus)
+	{
+		if (cpu / 64 == affinity.Group)
+		{
+			affinity.Mask |= KAFFINITY(1) << (cpu % 64);
+		}
+	}
+	return SetThreadGroupAffinity(GetCurrentThread(), &affinity, nullptr) != 0;
+}
+
+size_t current_cpu()
+{
+	PROCESSOR_NUMBER number = {};
+	GetCurrentProcessorNumberEx(&number);
+	return number.Group * 64 + number.Number;
+}
+
+#elif defined(__linux__)
+
+inline std::vector<size_t> parse_cpu_list(const std::string& list)
+{
+	std::vector<size_t> cpus;
+	size_t position = 0;
+	while (position < list.size())
+	{
+		size_t end = list.find(',', position);
+		std::string range = list.substr(position, end == std::string::npos ? std::string::npos : end - position);
+		size_t dash = range.find('-');
+		if (!range.empty() && range[0] >= '0' && range[0] <= '9')
+		{
+			size_t first = std::stoul(range.substr(0, dash));
+			size_t last = dash == std::string::npos ? first : std::stoul(range.substr(dash + 1));
+			for (size_t cpu = first; cpu <= last; cpu++)
+			{
+				cpus.push_back(cpu);
+			}
+		}
+		if (end == std::string::npos)
+		{
+			break;
+		}
+		position = end + 1;
+	}
+	return cpus;
+}
+
+std::vector<numa_node> detect_numa_nodes()
+{
+	std::vector<numa_node> nodes;
+	for (size_t node = 0; ; node++)
+	{
+		std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+		if (!file)
+		{
+			break;
+		}
+		std::string list;
+		std::getline(file, list);
+		numa_node current;
+		current.cpus = parse_cpu_list(list);
+		if (!current.cpus.empty())
+		{
+			nodes.push_back(current);
+		}
+	}
+	return nodes.empty() ? single_node_topology() : nodes;
+}
+
+bool pin_current_thread(const std::vector<size_t>& cpus)
+{
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for (size_t cpu : cpus)
+	{
+		if (cpu < CPU_SETSIZE)
+		{
+			CPU_SET(cpu, &set);
+		}
+	}
+	return !cpus.empty() && pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+size_t current_cpu()
+{
+	int cpu = sched_getcpu();
+	return cpu < 0 ? 0 : static_cast<size_t>(cpu);
+}
+
+#else
+
+std::vector<numa_node> detect_numa_nodes()
+{
+	return single_node_topology();
+}
+
+bool pin_current_thread(const std::vector<size_t>&)
+{
+	return false;
+}
+
+size_t current_cpu()
+{
+	return 0;
+}
+
+#endif
@@ -0,0 +1,138 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// Move-only replacement for std::function. Callables up to inline_size bytes
+// (with nothrow move) live in the object itself; larger ones go to the heap.
+template <typename signature_t, size_t inline_size = 64>
+class move_only_task;
+
+template <typename result_t, typename... arguments, size_t inline_size>
+class move_only_task<result_t(arguments...), inline_size>
+{
+	static_assert(inline_size >= sizeof(void*), "move_only_task needs room for at least a pointer");
+
+	template <typename callable_t>
+	static result_t call(callable_t& callable, arguments&&... parameters)
+	{
+		if constexpr (std::is_void_v<result_t>)
+		{
+			std::invoke(callable, std::forward<arguments>(parameters)...);
+		}
+		else
+		{
+			return std::invoke(callable, std::forward<arguments>(parameters)...);
+		}
+	}
+	struct operations
+	{
+		result_t(*invoke)(void* storage, arguments&&... parameters);
+		void(*move)(void* destination, void* source) noexcept;
+		void(*destroy)(void* storage) noexcept;
+	};
+	template <typename callable_t>
+	static constexpr bool stored_inline = sizeof(callable_t) <= inline_size
+		&& alignof(callable_t) <= alignof(std::max_align_t)
+		&& std::is_nothrow_move_constructible_v<callable_t>;
+	template <typename callable_t>
+	struct inline_operations
+	{
+		static result_t invoke(void* storage, arguments&&... parameters) { return call(*static_cast<callable_t*>(storage), std::forward<arguments>(parameters)...); }
+		static void move(void* destination, void* source) noexcept
+		{
+			new (destination) callable_t(std::move(*static_cast<callable_t*>(source)));
+			static_cast<callable_t*>(source)->~callable_t();
+		}
+		static void destroy(void* storage) noexcept { static_cast<callable_t*>(storage)->~callable_t(); }
+		static constexpr operations table = { &invoke, &move, &destroy };
+	};
+	template <typename callable_t>
+	struct heap_operations
+	{
+		static result_t invoke(void* storage, arguments&&... parameters) { return call(**static_cast<callable_t**>(storage), std::forward<arguments>(parameters)...); }
+		static void move(void* destination, void* source) noexcept { *static_cast<callable_t**>(destination) = *static_cast<callable_t**>(source); }
+		static void destroy(void* storage) noexcept { delete *static_cast<callable_t**>(storage); }
+		static constexpr operations table = { &invoke, &move, &destroy };
+	};
+public:
+	inline move_only_task() noexcept = default;
+	inline move_only_task(std::nullptr_t) noexcept {}
+	template <typename callable_t, typename = std::enable_if_t<!std::is_same_v<std::decay_t<callable_t>, move_only_task>>>
+	inline move_only_task(callable_t&& callable);
+	inline move_only_task(move_only_task&& other) noexcept;
+	inline move_only_task& operator=(move_only_task&& rhs) noexcept;
+	inline ~move_only_task() { reset(); }
+	inline explicit operator bool() const noexcept { return m_operations != nullptr; }
+	inline result_t operator()(arguments... parameters);
+	inline void reset() noexcept;
+public:
+	move_only_task(const move_only_task& other) = delete;
+	move_only_task& operator=(const move_only_task& rhs) = delete;
+private:
+	alignas(std::max_align_t) unsigned char m_storage[inline_size];
+	const operations* m_operations = nullptr;
+};
+
+template <typename result_t, typename... arguments, size_t inline_size>
+template <typename callable_t, typename>
+move_only_task<result_t(arguments...), inline_size>::move_only_task(callable_t&& callable)
+{
+	using stored_t = std::decay_t<callable_t>;
+	if constexpr (stored_inline<stored_t>)
+	{
+		new (m_storage) stored_t(std::forward<callable_t>(callable));
+		m_operations = &inline_operations<stored_t>::table;
+	}
+	else
+	{
+		*reinterpret_cast<stored_t**>(m_storage) = new stored_t(std::forward<callable_t>(callable));
+		m_operations = &heap_operations<stored_t>::table;
+	}
+}
+
+template <typename result_t, typename... arguments, size_t inline_size>
+move_only_task<result_t(arguments...), inline_size>::move_only_task(move_only_task&& other) noexcept
+{
+	if (other.m_operations != nullptr)
+	{
+		other.m_operations->move(m_storage, other.m_storage);
+		m_operations = other.m_operations;
+		other.m_operations = nullptr;
+	}
+}
+
+template <typename result_t, typename... arguments, size_t inline_size>
+move_only_task<result_t(arguments...), inline_size>& move_only_task<result_t(arguments...), inline_size>::operator=(move_only_task&& rhs) noexcept
+{
+	if (this != &rhs)
+	{
+		reset();
+		if (rhs.m_operations != nullptr)
+		{
+			rhs.m_operations->move(m_storage, rhs.m_storage);
+			m_operations = rhs.m_operations;
+			rhs.m_operations = nullptr;
+		}
+	}
+	return *this;
+}
+
+template <typename result_t, typename... arguments, size_t inline_size>
+result_t move_only_task<result_t(arguments...), inline_size>::operator()(arguments... parameters)
+{
+	return m_operations->invoke(m_storage, std::forward<arguments>(parameters)...);
+}
+
+template <typename result_t, typename... arguments, size_t inline_size>
+void move_only_task<result_t(arguments...), inline_size>::reset() noexcept
+{
+	if (m_operations != nullptr)
+	{
+		m_operations->destroy(m_storage);
+		m_operations = nullptr;
+	}
+}
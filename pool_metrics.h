@@ -0,0 +1,154 @@
+#pragma once
+
+#include "cache_line.h"
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Counter with a single writing thread: increments are a relaxed load and
+// store instead of a locked read-modify-write. Any thread may read it.
+class single_writer_counter
+{
+public:
+	inline void add(const uint64_t amount = 1) { m_value.store(m_value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed); }
+	inline uint64_t load() const { return m_value.load(std::memory_order_relaxed); }
+	inline void raise_to(const uint64_t value) { if (value > load()) { m_value.store(value, std::memory_order_relaxed); } }
+private:
+	std::atomic<uint64_t> m_value = 0;
+};
+
+struct histogram_snapshot;
+
+// Log-linear latency histogram in the style of HdrHistogram: every power of
+// two is split into sub_buckets linear buckets, so recorded values keep about
+// 1 / sub_buckets relative precision over the whole 64-bit range. Like
+// single_writer_counter, record() must only be called from one thread.
+class latency_histogram
+{
+public:
+	static constexpr size_t sub_bucket_bits = 4;
+	static constexpr size_t sub_buckets = size_t(1) << sub_bucket_bits;
+	static constexpr size_t bucket_count = (64 - sub_bucket_bits + 1) * sub_buckets;
+public:
+	inline latency_histogram() = default;
+	inline void record(const uint64_t value);
+	inline void merge_into(histogram_snapshot& snapshot) const;
+	static inline size_t bucket_of(const uint64_t value);
+	static inline uint64_t highest_in_bucket(const size_t bucket);
+	inline uint64_t count() const { return m_count.load(); }
+	inline uint64_t sum() const { return m_sum.load(); }
+public:
+	latency_histogram(const latency_histogram& other) = delete;
+	latency_histogram& operator=(const latency_histogram& rhs) = delete;
+private:
+	single_writer_counter m_counts[bucket_count];
+	single_writer_counter m_count;
+	single_writer_counter m_sum;
+	single_writer_counter m_max;
+};
+
+struct histogram_snapshot
+{
+	std::vector<uint64_t> counts = std::vector<uint64_t>(latency_histogram::bucket_count);
+	uint64_t count = 0;
+	uint64_t sum = 0;
+	uint64_t max = 0;
+	inline double mean() const { return count == 0 ? 0.0 : double(sum) / double(count); }
+	inline uint64_t percentile(const double percent) const;
+};
+
+// Everything a worker writes, on its own cache lines.
+struct alignas(cache_line_size) worker_metrics
+{
+	inline explicit worker_metrics(const size_t priority_classes) : queue_wait_by_priority(new latency_histogram[priority_classes]) {}
+	single_writer_counter tasks_executed;
+	single_writer_counter tasks_failed;
+	single_writer_counter queue_length_sum;
+	latency_histogram queue_wait;
+	latency_histogram execution;
+	latency_histogram end_to_end;
+	std::unique_ptr<latency_histogram[]> queue_wait_by_priority;
+};
+
+// Point-in-time view of the pool's metrics; latencies are in nanoseconds.
+struct pool_stats
+{
+	uint64_t tasks_submitted = 0;
+	uint64_t tasks_executed = 0;
+	// Executed tasks that threw; included in tasks_executed.
+	uint64_t tasks_failed = 0;
+	uint64_t tasks_pending = 0;
+	// Turned away or evicted by the backpressure policy.
+	uint64_t tasks_rejected = 0;
+	uint64_t tasks_dropped = 0;
+	double average_queue_length = 0.0;
+	histogram_snapshot queue_wait;
+	histogram_snapshot execution;
+	histogram_snapshot end_to_end;
+	std::vector<histogram_snapshot> queue_wait_by_priority;
+	std::vector<uint64_t> tasks_per_worker;
+};
+
+size_t latency_histogram::bucket_of(const uint64_t value)
+{
+	if (value < sub_buckets)
+	{
+		return static_cast<size_t>(value);
+	}
+	size_t exponent = std::bit_width(value) - 1 - sub_bucket_bits;
+	size_t mantissa = static_cast<size_t>(value >> exponent);
+	return (exponent + 1) * sub_buckets + (mantissa - sub_buckets);
+}
+
+uint64_t latency_histogram::highest_in_bucket(const size_t bucket)
+{
+	if (bucket < sub_buckets)
+	{
+		return bucket;
+	}
+	size_t exponent = bucket / sub_buckets - 1;
+	uint64_t mantissa = sub_buckets + bucket % sub_buckets;
+	return ((mantissa + 1) << exponent) - 1;
+}
+
+void latency_histogram::record(const uint64_t value)
+{
+	m_counts[bucket_of(value)].add();
+	m_count.add();
+	m_sum.add(value);
+	m_max.raise_to(value);
+}
+
+void latency_histogram::merge_into(histogram_snapshot& snapshot) const
+{
+	for (size_t bucket = 0; bucket < bucket_count; bucket++)
+	{
+		snapshot.counts[bucket] += m_counts[bucket].load();
+	}
+	snapshot.count += m_count.load();
+	snapshot.sum += m_sum.load();
+	snapshot.max = std::max(snapshot.max, m_max.load());
+}
+
+uint64_t histogram_snapshot::percentile(const double percent) const
+{
+	if (count == 0)
+	{
+		return 0;
+	}
+	uint64_t target = static_cast<uint64_t>(percent / 100.0 * double(count) + 0.5);
+	target = std::max<uint64_t>(target, 1);
+	uint64_t seen = 0;
+	for (size_t bucket = 0; bucket < counts.size(); bucket++)
+	{
+		seen += counts[bucket];
+		if (seen >= target)
+		{
+			return std::min(latency_histogram::highest_in_bucket(bucket), max);
+		}
+	}
+	return max;
+}
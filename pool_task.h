@@ -0,0 +1,189 @@
+#pragma once
+#include "thread_pool.h"
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+// Lazily started coroutine producing result_t. It starts when awaited, runs on
+// whichever thread resumes it and, when it finishes, resumes its awaiter on
+// the same thread. Inside one, co_await pool.schedule() moves onto a worker
+// and co_await pool.sleep_for() waits on the pool's timer without holding a
+// worker, so a small pool can keep thousands of them waiting. An exception
+// thrown in the body is rethrown by co_await.
+template <typename result_t = void>
+class pool_task;
+
+template <typename result_t>
+struct pool_task_promise;
+
+struct pool_task_promise_base
+{
+	// Hands control straight to the awaiter instead of returning to whoever
+	// resumed this coroutine.
+	struct final_awaiter
+	{
+		inline bool await_ready() const noexcept { return false; }
+		template <typename promise_t>
+		inline std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_t> handle) noexcept;
+		inline void await_resume() const noexcept {}
+	};
+	std::coroutine_handle<> continuation;
+	std::exception_ptr error;
+	inline std::suspend_always initial_suspend() const noexcept { return {}; }
+	inline final_awaiter final_suspend() const noexcept { return {}; }
+	inline void unhandled_exception() { error = std::current_exception(); }
+};
+
+template <typename result_t>
+struct pool_task_promise : pool_task_promise_base
+{
+	std::optional<result_t> value;
+	inline pool_task<result_t> get_return_object();
+	template <typename value_t>
+	inline void return_value(value_t&& result) { value.emplace(std::forward<value_t>(result)); }
+	inline result_t take();
+};
+
+template <>
+struct pool_task_promise<void> : pool_task_promise_base
+{
+	inline pool_task<void> get_return_object();
+	inline void return_void() {}
+	inline void take();
+};
+
+template <typename result_t>
+class pool_task
+{
+public:
+	using promise_type = pool_task_promise<result_t>;
+	using handle_type = std::coroutine_handle<promise_type>;
+	struct awaiter
+	{
+		handle_type handle;
+		inline bool await_ready() const noexcept { return handle.done(); }
+		inline std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept;
+		inline result_t await_resume() { return handle.promise().take(); }
+	};
+public:
+	inline pool_task() = default;
+	inline explicit pool_task(handle_type handle) : m_handle(handle) {}
+	inline pool_task(pool_task&& other) noexcept : m_handle(std::exchange(other.m_handle, nullptr)) {}
+	inline pool_task& operator=(pool_task&& rhs) noexcept;
+	inline ~pool_task() { if (m_handle) { m_handle.destroy(); } }
+	inline bool valid() const { return bool(m_handle); }
+	inline awaiter operator co_await() && { return awaiter{ m_handle }; }
+public:
+	pool_task(const pool_task& other) = delete;
+	pool_task& operator=(const pool_task& rhs) = delete;
+private:
+	handle_type m_handle;
+};
+
+// Frame of spawn(): starts running as soon as it is called and frees itself
+// when it finishes.
+struct detached_coroutine
+{
+	struct promise_type
+	{
+		inline detached_coroutine get_return_object() const noexcept { return {}; }
+		inline std::suspend_never initial_suspend() const noexcept { return {}; }
+		inline std::suspend_never final_suspend() const noexcept { return {}; }
+		inline void return_void() const noexcept {}
+		inline void unhandled_exception() const noexcept { std::terminate(); }
+	};
+};
+
+template <typename promise_t>
+std::coroutine_handle<> pool_task_promise_base::final_awaiter::await_suspend(std::coroutine_handle<promise_t> handle) noexcept
+{
+	std::coroutine_handle<> continuation = handle.promise().continuation;
+	return continuation ? continuation : std::noop_coroutine();
+}
+
+template <typename result_t>
+pool_task<result_t> pool_task_promise<result_t>::get_return_object()
+{
+	return pool_task<result_t>(std::coroutine_handle<pool_task_promise>::from_promise(*this));
+}
+
+template <typename result_t>
+result_t pool_task_promise<result_t>::take()
+{
+	if (error)
+	{
+		std::rethrow_exception(error);
+	}
+	return std::move(*value);
+}
+
+pool_task<void> pool_task_promise<void>::get_return_object()
+{
+	return pool_task<void>(std::coroutine_handle<pool_task_promise>::from_promise(*this));
+}
+
+void pool_task_promise<void>::take()
+{
+	if (error)
+	{
+		std::rethrow_exception(error);
+	}
+}
+
+template <typename result_t>
+pool_task<result_t>& pool_task<result_t>::operator=(pool_task&& rhs) noexcept
+{
+	if (this != &rhs)
+	{
+		if (m_handle)
+		{
+			m_handle.destroy();
+		}
+		m_handle = std::exchange(rhs.m_handle, nullptr);
+	}
+	return *this;
+}
+
+// Starts the awaited coroutine; it resumes the awaiter when it finishes.
+template <typename result_t>
+std::coroutine_handle<> pool_task<result_t>::awaiter::await_suspend(std::coroutine_handle<> awaiting) noexcept
+{
+	handle.promise().continuation = awaiting;
+	return handle;
+}
+
+template <typename policy_t, typename result_t>
+detached_coroutine run_detached(basic_thread_pool<policy_t>& pool, pool_task<result_t> task, task_promise<result_t> promise)
+{
+	try
+	{
+		co_await pool.schedule();
+		if constexpr (std::is_void_v<result_t>)
+		{
+			co_await std::move(task);
+			promise.set_value();
+		}
+		else
+		{
+			promise.set_value(co_await std::move(task));
+		}
+	}
+	catch (...)
+	{
+		promise.set_exception(std::current_exception());
+	}
+}
+
+// Runs task on one of pool's workers without waiting for it. The future gets
+// its result or the exception it threw, or the one schedule() threw if the
+// pool discarded it before it started.
+template <typename policy_t, typename result_t>
+task_future<result_t> spawn(basic_thread_pool<policy_t>& pool, pool_task<result_t> task)
+{
+	task_promise<result_t> promise;
+	task_future<result_t> future = promise.get_future();
+	run_detached(pool, std::move(task), std::move(promise));
+	return future;
+}
@@ -0,0 +1,401 @@
+#pragma once
+#include "thread_pool.h"
+#include <atomic>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Thread-per-core pool. Every shard is one worker with a private inbox, and a
+// keyed task always runs on the shard its key hashes to, so state owned by a
+// shard is only ever touched by that shard's thread and needs no lock. A
+// submit is one push onto the target inbox and shares nothing with the other
+// shards; there is no pool-wide lock or counter. Keyed work is never stolen,
+// so a hot key slows down only its own shard.
+class sharded_pool
+{
+	using task_type = move_only_task<void()>;
+	// Multi-producer, single-consumer queue (Vyukov): a push is one exchange on
+	// head, a pop only touches tail. tail always points at a spent node whose
+	// successor holds the next task.
+	struct inbox_node {
+		std::atomic<inbox_node*> next = nullptr;
+		task_type task;
+		static inline void* operator new(const size_t) { return slab_allocator<inbox_node>().allocate(1); }
+		static inline void operator delete(void* pointer) noexcept { slab_allocator<inbox_node>().deallocate(static_cast<inbox_node*>(pointer), 1); }
+	};
+	struct alignas(cache_line_size) shard {
+		// Producer side. The low bits of producers count pushes in progress;
+		// closed_bit stops new ones.
+		std::atomic<inbox_node*> head;
+		std::atomic<size_t> producers = 0;
+		std::atomic<bool> sleeping = false;
+		std::atomic<uint32_t> wake_epoch = 0;
+		// Consumer side.
+		alignas(cache_line_size) inbox_node* tail;
+		std::atomic<bool> stopping = false;
+		std::vector<size_t> cpus;
+		std::thread thread;
+		inline shard() : head(new inbox_node), tail(head.load()) {}
+		inline ~shard();
+		inline bool empty() const { return tail->next.load(std::memory_order_acquire) == nullptr && head.load() == tail; }
+		inline void push(inbox_node* node);
+		inline bool pop(task_type& task);
+	};
+	static constexpr size_t closed_bit = size_t(1) << (sizeof(size_t) * 8 - 1);
+public:
+	inline sharded_pool() = default;
+	inline ~sharded_pool() { terminate(); }
+public:
+	void initialize(const size_t shard_count, const bool pin_shards = true);
+	void terminate();
+	void set_idle_policy(const idle_policy& policy);
+	void set_error_handler(std::function<void(size_t, std::exception_ptr)> handler);
+	inline bool working() const { return m_working.load(); }
+	inline size_t shard_count() const { return m_shards.size(); }
+	inline size_t current_shard() const { return s_current_pool == this ? s_current_shard : size_t(-1); }
+	template <typename key_t>
+	inline size_t shard_of(const key_t& key) const;
+	template <typename key_t, typename task_t, typename... arguments>
+	inline bool add_task(const key_t& key, task_t&& task, arguments&&... parameters);
+	template <typename key_t, typename task_t, typename... arguments>
+	inline auto submit(const key_t& key, task_t&& task, arguments&&... parameters);
+	template <typename task_t>
+	inline task_future<void> broadcast(task_t&& task);
+public:
+	sharded_pool(const sharded_pool& other) = delete;
+	sharded_pool(sharded_pool&& other) = delete;
+	sharded_pool& operator=(const sharded_pool& rhs) = delete;
+	sharded_pool& operator=(sharded_pool&& rhs) = delete;
+private:
+	inline bool push_to(const size_t index, task_type&& task);
+	inline void shard_routine(const size_t index);
+	inline void idle_wait(shard& self);
+	std::vector<std::unique_ptr<shard>> m_shards;
+	std::atomic<bool> m_working = false;
+	idle_policy m_idle;
+	std::function<void(size_t, std::exception_ptr)> m_error_handler;
+	std::mutex m_lifecycle_lock;
+	inline static thread_local const sharded_pool* s_current_pool = nullptr;
+	inline static thread_local size_t s_current_shard = 0;
+};
+
+// Whatever is still queued when the shard goes away is destroyed unrun, which
+// breaks the futures of submitted tasks.
+sharded_pool::shard::~shard()
+{
+	task_type discarded;
+	while (pop(discarded))
+	{
+	}
+	delete tail;
+}
+
+void sharded_pool::shard::push(inbox_node* node)
+{
+	inbox_node* previous = head.exchange(node);
+	previous->next.store(node, std::memory_order_release);
+}
+
+bool sharded_pool::shard::pop(task_type& task)
+{
+	inbox_node* next = tail->next.load(std::memory_order_acquire);
+	if (next == nullptr)
+	{
+		return false;
+	}
+	task = std::move(next->task);
+	delete tail;
+	tail = next;
+	return true;
+}
+
+// pin_shards puts shard i on logical CPU i, taking the CPUs node by node and
+// wrapping around when there are more shards than CPUs.
+void sharded_pool::initialize(const size_t shard_count, const bool pin_shards)
+{
+	std::lock_guard<std::mutex> _(m_lifecycle_lock);
+	if (m_working || shard_count == 0)
+	{
+		return;
+	}
+	m_shards.clear();
+	std::vector<size_t> cpus;
+	if (pin_shards)
+	{
+		for (numa_node& node : detect_numa_nodes())
+		{
+			cpus.insert(cpus.end(), node.cpus.begin(), node.cpus.end());
+		}
+	}
+	for (size_t index = 0; index < shard_count; index++)
+	{
+		m_shards.emplace_back(new shard);
+		if (!cpus.empty())
+		{
+			m_shards[index]->cpus.push_back(cpus[index % cpus.size()]);
+		}
+	}
+	m_working = true;
+	for (size_t index = 0; index < shard_count; index++)
+	{
+		m_shards[index]->thread = std::thread(&sharded_pool::shard_routine, this, index);
+	}
+}
+
+// Stops taking tasks, lets every shard finish what is in its inbox and joins
+// them. A submit racing with this either gets in before its shard closes and
+// runs, or fails.
+void sharded_pool::terminate()
+{
+	std::lock_guard<std::mutex> _(m_lifecycle_lock);
+	if (!m_working)
+	{
+		return;
+	}
+	m_working = false;
+	for (std::unique_ptr<shard>& target : m_shards)
+	{
+		target->producers.fetch_or(closed_bit);
+	}
+	for (std::unique_ptr<shard>& target : m_shards)
+	{
+		while ((target->producers.load() & ~closed_bit) != 0)
+		{
+			std::this_thread::yield();
+		}
+		target->stopping = true;
+		target->wake_epoch.fetch_add(1);
+		target->wake_epoch.notify_one();
+	}
+	for (std::unique_ptr<shard>& target : m_shards)
+	{
+		if (target->thread.joinable())
+		{
+			target->thread.join();
+		}
+	}
+}
+
+void sharded_pool::set_idle_policy(const idle_policy& policy)
+{
+	std::lock_guard<std::mutex> _(m_lifecycle_lock);
+	if (m_working)
+	{
+		return;
+	}
+	m_idle = policy;
+}
+
+// As thread_pool::set_error_handler(), but handler gets the shard index, since
+// sharded tasks have no ids.
+void sharded_pool::set_error_handler(std::function<void(size_t, std::exception_ptr)> handler)
+{
+	std::lock_guard<std::mutex> _(m_lifecycle_lock);
+	if (m_working)
+	{
+		return;
+	}
+	m_error_handler = std::move(handler);
+}
+
+// The hash is mixed before it is reduced, since std::hash is the identity for
+// integers on common standard libraries and keys such as aligned addresses
+// would otherwise land on a few shards.
+template <typename key_t>
+size_t sharded_pool::shard_of(const key_t& key) const
+{
+	uint64_t mixed = uint64_t(std::hash<key_t>{}(key)) * 0x9E3779B97F4A7C15ull;
+	return size_t(mixed >> 32) % m_shards.size();
+}
+
+// False if the pool is not running.
+template <typename key_t, typename task_t, typename... arguments>
+bool sharded_pool::add_task(const key_t& key, task_t&& task, arguments&&... parameters)
+{
+	if (!m_working.load(std::memory_order_relaxed))
+	{
+		return false;
+	}
+	return push_to(shard_of(key), [function = std::forward<task_t>(task), ...values = std::forward<arguments>(parameters)]() mutable {
+		std::invoke(std::move(function), std::move(values)...);
+	});
+}
+
+// The future is broken if the pool is not running.
+template <typename key_t, typename task_t, typename... arguments>
+auto sharded_pool::submit(const key_t& key, task_t&& task, arguments&&... parameters)
+{
+	using result_t = std::invoke_result_t<std::decay_t<task_t>, std::decay_t<arguments>...>;
+	task_promise<result_t> promise;
+	task_future<result_t> future = promise.get_future();
+	add_task(key, [promise = std::move(promise), function = std::forward<task_t>(task), ...values = std::forward<arguments>(parameters)]() mutable {
+		try {
+			if constexpr (std::is_void_v<result_t>) {
+				std::invoke(std::move(function), std::move(values)...);
+				promise.set_value();
+			}
+			else {
+				promise.set_value(std::invoke(std::move(function), std::move(values)...));
+			}
+		}
+		catch (...) {
+			promise.set_exception(std::current_exception());
+		}
+	});
+	return future;
+}
+
+// Runs a copy of task(shard index) on every shard, behind whatever each one
+// already has queued. The future completes once all of them have returned,
+// rethrows the first exception one of them threw, and is broken if the pool
+// stopped before every shard got its copy.
+template <typename task_t>
+task_future<void> sharded_pool::broadcast(task_t&& task)
+{
+	struct broadcast_state
+	{
+		std::atomic<size_t> remaining;
+		std::atomic<bool> failed = false;
+		std::exception_ptr error;
+		task_promise<void> promise;
+	};
+	auto state = std::make_shared<broadcast_state>();
+	state->remaining = m_shards.size();
+	task_future<void> future = state->promise.get_future();
+	if (!m_working.load(std::memory_order_relaxed))
+	{
+		return future;
+	}
+	for (size_t index = 0; index < m_shards.size(); index++)
+	{
+		bool pushed = push_to(index, [state, index, function = std::decay_t<task_t>(task)]() mutable {
+			try
+			{
+				std::invoke(function, index);
+			}
+			catch (...)
+			{
+				if (!state->failed.exchange(true, std::memory_order_relaxed))
+				{
+					state->error = std::current_exception();
+				}
+			}
+			if (state->remaining.fetch_sub(1) != 1)
+			{
+				return;
+			}
+			if (state->error)
+			{
+				state->promise.set_exception(state->error);
+			}
+			else
+			{
+				state->promise.set_value();
+			}
+		});
+		if (!pushed)
+		{
+			break;
+		}
+	}
+	return future;
+}
+
+bool sharded_pool::push_to(const size_t index, task_type&& task)
+{
+	shard& target = *m_shards[index];
+	if (target.producers.fetch_add(1) & closed_bit)
+	{
+		target.producers.fetch_sub(1);
+		return false;
+	}
+	inbox_node* node = new inbox_node;
+	node->task = std::move(task);
+	target.push(node);
+	// Pairs with idle_wait(): the push and the read of sleeping are both
+	// seq_cst, as are the shard's write of sleeping and its re-check.
+	if (target.sleeping.load())
+	{
+		target.wake_epoch.fetch_add(1);
+		target.wake_epoch.notify_one();
+	}
+	target.producers.fetch_sub(1);
+	return true;
+}
+
+void sharded_pool::shard_routine(const size_t index)
+{
+	shard& self = *m_shards[index];
+	if (!self.cpus.empty())
+	{
+		pin_current_thread(self.cpus);
+	}
+	s_current_pool = this;
+	s_current_shard = index;
+	task_type task;
+	while (true)
+	{
+		if (self.pop(task))
+		{
+			try
+			{
+				task();
+			}
+			catch (...)
+			{
+				if (m_error_handler)
+				{
+					m_error_handler(index, std::current_exception());
+				}
+			}
+			task.reset();
+			continue;
+		}
+		if (self.stopping.load() && self.empty())
+		{
+			break;
+		}
+		idle_wait(self);
+	}
+	s_current_pool = nullptr;
+}
+
+// A push caught between its exchange and linking the node leaves the inbox
+// looking non-empty with nothing to pop yet; the shard then yields until it
+// shows up rather than parking.
+void sharded_pool::idle_wait(shard& self)
+{
+	for (size_t spin = 0; spin < m_idle.spin_count; spin++)
+	{
+		if (!self.empty())
+		{
+			return;
+		}
+		cpu_relax();
+	}
+	for (size_t round = 0; round < m_idle.yield_count; round++)
+	{
+		if (!self.empty())
+		{
+			return;
+		}
+		std::this_thread::yield();
+	}
+	slab_cache::release_idle();
+	uint32_t epoch = self.wake_epoch.load();
+	self.sleeping.store(true);
+	if (self.empty() && !self.stopping.load())
+	{
+		self.wake_epoch.wait(epoch);
+	}
+	else
+	{
+		std::this_thread::yield();
+	}
+	self.sleeping.store(false);
+}
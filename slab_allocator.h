@@ -0,0 +1,387 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <new>
+#include <vector>
+
+// Per-thread size-class allocator for the small blocks that move between
+// producers and workers: queue chunks, stealing nodes, future states. Each
+// thread carves blocks out of its own 64 KiB slabs and keeps a free list per
+// size class, so allocate() and a free on the allocating thread touch no
+// shared state. A block freed on another thread goes back to the thread that
+// carved it: the freeing thread collects such blocks per owner and hands them
+// over batch_size at a time with one atomic push, and the owner takes all of
+// them back at once when its own list runs dry, or when it goes idle. Once a
+// class has piled up trim_slabs slabs' worth of free blocks, slabs with every
+// block free are returned to the system, apart from retained_slabs of them.
+// A finished thread's cache is kept for the next thread to adopt. Blocks
+// larger than the largest class come from operator new.
+class slab_cache
+{
+	static constexpr size_t min_shift = 4;
+	static constexpr size_t class_count = 7;
+	static constexpr size_t max_block = size_t(1) << (min_shift + class_count - 1);
+	static constexpr size_t slab_size = size_t(1) << 16;
+	static constexpr size_t batch_size = 32;
+	static constexpr size_t retained_slabs = 2;
+	static constexpr size_t trim_slabs = 4;
+	// Starts every slab. free_seen is scratch space for trim().
+	struct alignas(std::max_align_t) slab_record
+	{
+		size_t size_class;
+		size_t free_seen;
+	};
+	// Precedes every block; written once when the slab is carved. slab is
+	// null for a large block.
+	struct alignas(std::max_align_t) block_header
+	{
+		slab_cache* owner;
+		slab_record* slab;
+	};
+	struct free_block
+	{
+		free_block* next;
+	};
+	// Blocks freed here that belong to another thread, waiting for a full batch.
+	struct outgoing
+	{
+		slab_cache* owner = nullptr;
+		free_block* head = nullptr;
+		free_block* tail = nullptr;
+		size_t count = 0;
+	};
+	struct registry
+	{
+		std::mutex lock;
+		std::vector<slab_cache*> idle;
+	};
+	struct thread_binding
+	{
+		inline ~thread_binding();
+	};
+public:
+	static inline void* allocate(const size_t size);
+	static inline void deallocate(void* pointer) noexcept;
+	static inline void release_idle() noexcept;
+public:
+	slab_cache(const slab_cache& other) = delete;
+	slab_cache& operator=(const slab_cache& rhs) = delete;
+private:
+	inline slab_cache() = default;
+	static inline size_t class_of(const size_t size);
+	static inline size_t stride_of(const size_t size_class) { return sizeof(block_header) + (size_t(1) << (min_shift + size_class)); }
+	static inline size_t blocks_per_slab(const size_t size_class) { return (slab_size - sizeof(slab_record)) / stride_of(size_class); }
+	static inline block_header* header_of(void* pointer) { return static_cast<block_header*>(pointer) - 1; }
+	static inline registry& caches();
+	static inline slab_cache* current();
+	inline void* take(const size_t size_class);
+	inline void carve(const size_t size_class);
+	inline void give_back(free_block* block, block_header* header) noexcept;
+	inline void flush(outgoing& pending) noexcept;
+	inline void flush_all() noexcept;
+	inline void trim(const size_t size_class) noexcept;
+	free_block* m_free[class_count] = {};
+	// Only steers trim(), so it may briefly disagree with m_free while
+	// returned blocks are in flight.
+	std::ptrdiff_t m_free_count[class_count] = {};
+	std::ptrdiff_t m_trim_at[class_count] = {};
+	std::atomic<free_block*> m_returned[class_count] = {};
+	std::atomic<size_t> m_returned_count[class_count] = {};
+	outgoing m_outgoing[class_count];
+	std::vector<slab_record*> m_slabs;
+	inline static thread_local slab_cache* s_current = nullptr;
+	inline static thread_local bool s_thread_exited = false;
+};
+
+// Standard allocator over slab_cache, for containers and allocate_shared().
+template <typename value_type_t>
+class slab_allocator
+{
+	static_assert(alignof(value_type_t) <= alignof(std::max_align_t), "slab_allocator does not support over-aligned types");
+public:
+	using value_type = value_type_t;
+public:
+	inline slab_allocator() noexcept = default;
+	template <typename other_t>
+	inline slab_allocator(const slab_allocator<other_t>&) noexcept {}
+	inline value_type_t* allocate(const size_t count) { return static_cast<value_type_t*>(slab_cache::allocate(count * sizeof(value_type_t))); }
+	inline void deallocate(value_type_t* pointer, const size_t) noexcept { slab_cache::deallocate(pointer); }
+};
+
+template <typename lhs_t, typename rhs_t>
+inline bool operator==(const slab_allocator<lhs_t>&, const slab_allocator<rhs_t>&) noexcept { return true; }
+
+size_t slab_cache::class_of(const size_t size)
+{
+	size_t size_class = 0;
+	while ((size_t(1) << (min_shift + size_class)) < size)
+	{
+		size_class++;
+	}
+	return size_class;
+}
+
+void* slab_cache::allocate(const size_t size)
+{
+	if (size > max_block)
+	{
+		block_header* header = static_cast<block_header*>(::operator new(sizeof(block_header) + size));
+		header->owner = nullptr;
+		header->slab = nullptr;
+		return header + 1;
+	}
+	return current()->take(class_of(size));
+}
+
+void slab_cache::deallocate(void* pointer) noexcept
+{
+	if (pointer == nullptr)
+	{
+		return;
+	}
+	block_header* header = header_of(pointer);
+	if (header->slab == nullptr)
+	{
+		::operator delete(header);
+		return;
+	}
+	current()->give_back(static_cast<free_block*>(pointer), header);
+}
+
+// For a thread about to park: hands over its partial batches, so their
+// owners need not wait for it, and trims the classes that have grown past
+// their mark. A thread without a cache has nothing to do.
+void slab_cache::release_idle() noexcept
+{
+	slab_cache* cache = s_current;
+	if (cache == nullptr)
+	{
+		return;
+	}
+	cache->flush_all();
+	for (size_t size_class = 0; size_class < class_count; size_class++)
+	{
+		std::ptrdiff_t returned = static_cast<std::ptrdiff_t>(cache->m_returned_count[size_class].load(std::memory_order_relaxed));
+		if (cache->m_trim_at[size_class] != 0 && cache->m_free_count[size_class] + returned >= cache->m_trim_at[size_class])
+		{
+			cache->trim(size_class);
+		}
+	}
+}
+
+// Never destroyed, so threads that exit during static destruction can still
+// park their cache.
+slab_cache::registry& slab_cache::caches()
+{
+	static registry* instance = new registry;
+	return *instance;
+}
+
+// A thread that frees after its thread_local objects are gone still gets a
+// cache, which it then keeps.
+slab_cache* slab_cache::current()
+{
+	if (s_current != nullptr)
+	{
+		return s_current;
+	}
+	{
+		registry& shared = caches();
+		std::lock_guard<std::mutex> lock(shared.lock);
+		if (!shared.idle.empty())
+		{
+			s_current = shared.idle.back();
+			shared.idle.pop_back();
+		}
+	}
+	if (s_current == nullptr)
+	{
+		s_current = new slab_cache;
+	}
+	if (!s_thread_exited)
+	{
+		static thread_local thread_binding binding;
+		(void)binding;
+	}
+	return s_current;
+}
+
+slab_cache::thread_binding::~thread_binding()
+{
+	slab_cache* cache = s_current;
+	s_thread_exited = true;
+	s_current = nullptr;
+	if (cache == nullptr)
+	{
+		return;
+	}
+	cache->flush_all();
+	registry& shared = caches();
+	std::lock_guard<std::mutex> lock(shared.lock);
+	shared.idle.push_back(cache);
+}
+
+void* slab_cache::take(const size_t size_class)
+{
+	if (m_free[size_class] == nullptr)
+	{
+		m_free[size_class] = m_returned[size_class].exchange(nullptr, std::memory_order_acquire);
+		m_free_count[size_class] += static_cast<std::ptrdiff_t>(m_returned_count[size_class].exchange(0, std::memory_order_relaxed));
+		if (m_free[size_class] == nullptr)
+		{
+			carve(size_class);
+		}
+	}
+	free_block* block = m_free[size_class];
+	m_free[size_class] = block->next;
+	m_free_count[size_class]--;
+	return block;
+}
+
+// Only called with the class's list empty, so the trim mark starts over.
+void slab_cache::carve(const size_t size_class)
+{
+	size_t stride = stride_of(size_class);
+	unsigned char* memory = static_cast<unsigned char*>(::operator new(slab_size));
+	slab_record* slab = reinterpret_cast<slab_record*>(memory);
+	slab->size_class = size_class;
+	slab->free_seen = 0;
+	m_slabs.push_back(slab);
+	for (size_t offset = sizeof(slab_record); offset + stride <= slab_size; offset += stride)
+	{
+		block_header* header = reinterpret_cast<block_header*>(memory + offset);
+		header->owner = this;
+		header->slab = slab;
+		free_block* block = reinterpret_cast<free_block*>(header + 1);
+		block->next = m_free[size_class];
+		m_free[size_class] = block;
+	}
+	m_free_count[size_class] = static_cast<std::ptrdiff_t>(blocks_per_slab(size_class));
+	m_trim_at[size_class] = static_cast<std::ptrdiff_t>(trim_slabs * blocks_per_slab(size_class));
+}
+
+void slab_cache::give_back(free_block* block, block_header* header) noexcept
+{
+	size_t size_class = header->slab->size_class;
+	if (header->owner == this)
+	{
+		block->next = m_free[size_class];
+		m_free[size_class] = block;
+		if (++m_free_count[size_class] >= m_trim_at[size_class])
+		{
+			trim(size_class);
+		}
+		return;
+	}
+	outgoing& pending = m_outgoing[size_class];
+	if (pending.owner != header->owner)
+	{
+		flush(pending);
+		pending.owner = header->owner;
+	}
+	block->next = pending.head;
+	pending.head = block;
+	if (pending.tail == nullptr)
+	{
+		pending.tail = block;
+	}
+	// After thread exit nothing would flush a partial batch later.
+	if (++pending.count == batch_size || s_thread_exited)
+	{
+		flush(pending);
+	}
+}
+
+void slab_cache::flush(outgoing& pending) noexcept
+{
+	if (pending.head == nullptr)
+	{
+		return;
+	}
+	size_t size_class = header_of(pending.head)->slab->size_class;
+	// Counted first, so the owner's count can run ahead of its list but
+	// never behind it.
+	pending.owner->m_returned_count[size_class].fetch_add(pending.count, std::memory_order_relaxed);
+	std::atomic<free_block*>& returned = pending.owner->m_returned[size_class];
+	free_block* head = returned.load(std::memory_order_relaxed);
+	do
+	{
+		pending.tail->next = head;
+	} while (!returned.compare_exchange_weak(head, pending.head, std::memory_order_release, std::memory_order_relaxed));
+	pending.head = nullptr;
+	pending.tail = nullptr;
+	pending.count = 0;
+}
+
+void slab_cache::flush_all() noexcept
+{
+	for (outgoing& pending : m_outgoing)
+	{
+		flush(pending);
+	}
+}
+
+// Takes back the blocks other threads returned, counts the free blocks of
+// each slab in one pass over the list and frees the slabs found entirely
+// free, beyond the first retained_slabs. A slab with a block anywhere else,
+// in use or on another thread's way back, is kept. The mark then moves
+// trim_slabs slabs past what is left, so the pass is paid for by that many
+// frees.
+void slab_cache::trim(const size_t size_class) noexcept
+{
+	free_block* returned = m_returned[size_class].exchange(nullptr, std::memory_order_acquire);
+	m_returned_count[size_class].exchange(0, std::memory_order_relaxed);
+	while (returned != nullptr)
+	{
+		free_block* next = returned->next;
+		returned->next = m_free[size_class];
+		m_free[size_class] = returned;
+		returned = next;
+	}
+	for (free_block* block = m_free[size_class]; block != nullptr; block = block->next)
+	{
+		header_of(block)->slab->free_seen++;
+	}
+	size_t full = blocks_per_slab(size_class);
+	size_t kept = 0;
+	for (slab_record* slab : m_slabs)
+	{
+		if (slab->size_class == size_class && slab->free_seen == full && kept++ >= retained_slabs)
+		{
+			slab->free_seen = size_t(-1);
+		}
+	}
+	free_block** link = &m_free[size_class];
+	std::ptrdiff_t count = 0;
+	while (*link != nullptr)
+	{
+		if (header_of(*link)->slab->free_seen == size_t(-1))
+		{
+			*link = (*link)->next;
+		}
+		else
+		{
+			link = &(*link)->next;
+			count++;
+		}
+	}
+	size_t slab_count = 0;
+	for (slab_record* slab : m_slabs)
+	{
+		if (slab->size_class == size_class && slab->free_seen == size_t(-1))
+		{
+			::operator delete(slab);
+			continue;
+		}
+		if (slab->size_class == size_class)
+		{
+			slab->free_seen = 0;
+		}
+		m_slabs[slab_count++] = slab;
+	}
+	m_slabs.resize(slab_count);
+	m_free_count[size_class] = count;
+	m_trim_at[size_class] = count + static_cast<std::ptrdiff_t>(trim_slabs * full);
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+#include "cache_line.h"
+#include <mutex>
+#include <memory>
+#include <vector>
+
+// Fixed-size, sharded table of per-task records indexed by task id. Ids map to
+// shard id % shard_count and to a slot in that shard's ring, so the table never
+// rehashes and holds at most `retention` records: once a slot is reused by a
+// newer id, the older record is forgotten. Consumed records are released early.
+template <typename value_type_t>
+class status_table
+{
+	struct slot
+	{
+		size_t id = 0;
+		bool occupied = false;
+		bool consumed = false;
+		value_type_t value{};
+	};
+	struct alignas(cache_line_size) shard
+	{
+		std::mutex lock;
+		std::vector<slot> slots;
+	};
+public:
+	inline explicit status_table(const size_t retention = 1 << 16, const size_t shard_count = 16);
+	inline ~status_table() = default;
+	inline size_t retention() const { return m_shard_capacity * m_shard_count; }
+	inline void resize(const size_t retention);
+public:
+	template <typename updater_t>
+	inline bool update(const size_t id, updater_t&& updater);
+	inline bool load(const size_t id, value_type_t& value) const;
+	inline bool erase(const size_t id);
+public:
+	status_table(const status_table& other) = delete;
+	status_table(status_table&& other) = delete;
+	status_table& operator=(const status_table& rhs) = delete;
+	status_table& operator=(status_table&& rhs) = delete;
+private:
+	inline shard& shard_of(const size_t id) const { return m_shards[id % m_shard_count]; }
+	inline size_t index_of(const size_t id) const { return (id / m_shard_count) & (m_shard_capacity - 1); }
+	size_t m_shard_count = 0;
+	size_t m_shard_capacity = 0;
+	std::unique_ptr<shard[]> m_shards;
+};
+
+template <typename value_type_t>
+status_table<value_type_t>::status_table(const size_t retention, const size_t shard_count) : m_shard_count(shard_count)
+{
+	resize(retention);
+}
+
+// Not thread-safe; only call while no other thread uses the table.
+template <typename value_type_t>
+void status_table<value_type_t>::resize(const size_t retention)
+{
+	m_shard_capacity = 1;
+	while (m_shard_capacity * m_shard_count < retention)
+	{
+		m_shard_capacity <<= 1;
+	}
+	m_shards.reset(new shard[m_shard_count]);
+	for (size_t index = 0; index < m_shard_count; index++)
+	{
+		m_shards[index].slots.resize(m_shard_capacity);
+	}
+}
+
+// Applies updater to the record of id, creating a default record first if id
+// is newer than what the slot holds. Returns false if id was already forgotten
+// or consumed.
+template <typename value_type_t>
+template <typename updater_t>
+bool status_table<value_type_t>::update(const size_t id, updater_t&& updater)
+{
+	shard& owner = shard_of(id);
+	std::lock_guard<std::mutex> _(owner.lock);
+	slot& target = owner.slots[index_of(id)];
+	if (target.occupied && (target.id > id || (target.id == id && target.consumed)))
+	{
+		return false;
+	}
+	if (!target.occupied || target.id != id)
+	{
+		target.id = id;
+		target.occupied = true;
+		target.consumed = false;
+		target.value = value_type_t{};
+	}
+	updater(target.value);
+	return true;
+}
+
+template <typename value_type_t>
+bool status_table<value_type_t>::load(const size_t id, value_type_t& value) const
+{
+	shard& owner = shard_of(id);
+	std::lock_guard<std::mutex> _(owner.lock);
+	const slot& target = owner.slots[index_of(id)];
+	if (!target.occupied || target.id != id || target.consumed)
+	{
+		return false;
+	}
+	value = target.value;
+	return true;
+}
+
+template <typename value_type_t>
+bool status_table<value_type_t>::erase(const size_t id)
+{
+	shard& owner = shard_of(id);
+	std::lock_guard<std::mutex> _(owner.lock);
+	slot& target = owner.slots[index_of(id)];
+	if (!target.occupied || target.id != id || target.consumed)
+	{
+		return false;
+	}
+	target.consumed = true;
+	target.value = value_type_t{};
+	return true;
+}
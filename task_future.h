@@ -0,0 +1,329 @@
+#pragma once
+
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "slab_allocator.h"
+
+template <typename result_t>
+class task_future;
+
+// What get() throws for a task the pool evicted unrun under
+// overflow_policy::drop_oldest.
+class task_dropped : public std::runtime_error
+{
+public:
+	inline task_dropped() : std::runtime_error("task dropped to make room in the pool") {}
+};
+
+// While one is alive on a thread, a promise destroyed there unfulfilled fails
+// its futures with error instead of breaking them. Lets the pool say why it
+// discarded a task without knowing what the task holds.
+class abandon_reason
+{
+public:
+	inline explicit abandon_reason(std::exception_ptr error) : m_previous(std::exchange(s_current, std::move(error))) {}
+	inline ~abandon_reason() { s_current = std::move(m_previous); }
+	static inline std::exception_ptr current() { return s_current; }
+public:
+	abandon_reason(const abandon_reason& other) = delete;
+	abandon_reason& operator=(const abandon_reason& rhs) = delete;
+private:
+	std::exception_ptr m_previous;
+	inline static thread_local std::exception_ptr s_current;
+};
+
+template <typename result_t, typename continuation_t>
+struct continuation_result_of { using type = std::invoke_result_t<continuation_t, result_t&>; };
+
+template <typename continuation_t>
+struct continuation_result_of<void, continuation_t> { using type = std::invoke_result_t<continuation_t>; };
+
+// Shared state between one task_promise and any number of task_future copies.
+// The result, or the exception the task threw, lives here rather than in the
+// pool's status table.
+template <typename result_t>
+class task_state
+{
+public:
+	using storage_type = std::conditional_t<std::is_void_v<result_t>, bool, result_t>;
+public:
+	inline task_state() = default;
+	inline bool ready() const;
+	inline bool has_value() const;
+	inline std::exception_ptr error() const;
+	inline void wait() const;
+	template <typename rep, typename period>
+	inline bool wait_for(const std::chrono::duration<rep, period>& timeout) const;
+	inline storage_type& value();
+public:
+	template <typename... arguments>
+	inline void set_value(arguments&&... value);
+	inline void set_exception(std::exception_ptr error);
+	inline void abandon();
+	inline void on_ready(std::function<void()> continuation);
+public:
+	task_state(const task_state& other) = delete;
+	task_state(task_state&& other) = delete;
+	task_state& operator=(const task_state& rhs) = delete;
+	task_state& operator=(task_state&& rhs) = delete;
+private:
+	inline void finish(std::unique_lock<std::mutex>& lock);
+	mutable std::mutex m_lock;
+	mutable std::condition_variable m_ready;
+	std::optional<storage_type> m_value;
+	std::exception_ptr m_error;
+	std::vector<std::function<void()>> m_continuations;
+	bool m_finished = false;
+};
+
+template <typename result_t>
+class task_promise
+{
+public:
+	inline task_promise() : m_state(std::allocate_shared<task_state<result_t>>(slab_allocator<task_state<result_t>>())) {}
+	inline ~task_promise() { release(); }
+	inline task_promise(task_promise&& other) noexcept = default;
+	inline task_promise& operator=(task_promise&& rhs) noexcept;
+	inline task_future<result_t> get_future() const { return task_future<result_t>(m_state); }
+	template <typename... arguments>
+	inline void set_value(arguments&&... value) { m_state->set_value(std::forward<arguments>(value)...); }
+	inline void set_exception(std::exception_ptr error) { m_state->set_exception(std::move(error)); }
+public:
+	task_promise(const task_promise& other) = delete;
+	task_promise& operator=(const task_promise& rhs) = delete;
+private:
+	// A promise destroyed before set_value() breaks its futures instead of
+	// leaving them waiting forever, e.g. when terminate_now() drops the task.
+	inline void release() { if (m_state) { m_state->abandon(); } }
+	std::shared_ptr<task_state<result_t>> m_state;
+};
+
+template <typename result_t>
+class task_future
+{
+	template <typename continuation_t>
+	using continuation_result = typename continuation_result_of<result_t, continuation_t>::type;
+public:
+	inline task_future() = default;
+	inline explicit task_future(std::shared_ptr<task_state<result_t>> state) : m_state(std::move(state)) {}
+	inline bool valid() const { return m_state != nullptr; }
+	inline bool ready() const { return m_state->ready(); }
+	inline void wait() const { m_state->wait(); }
+	template <typename rep, typename period>
+	inline bool wait_for(const std::chrono::duration<rep, period>& timeout) const { return m_state->wait_for(timeout); }
+	inline result_t get();
+	template <typename continuation_t>
+	inline task_future<continuation_result<continuation_t>> then(continuation_t&& continuation);
+private:
+	std::shared_ptr<task_state<result_t>> m_state;
+};
+
+template <typename result_t>
+bool task_state<result_t>::ready() const
+{
+	std::lock_guard<std::mutex> _(m_lock);
+	return m_finished;
+}
+
+template <typename result_t>
+bool task_state<result_t>::has_value() const
+{
+	std::lock_guard<std::mutex> _(m_lock);
+	return m_value.has_value();
+}
+
+template <typename result_t>
+std::exception_ptr task_state<result_t>::error() const
+{
+	std::lock_guard<std::mutex> _(m_lock);
+	return m_error;
+}
+
+template <typename result_t>
+void task_state<result_t>::wait() const
+{
+	std::unique_lock<std::mutex> _(m_lock);
+	m_ready.wait(_, [this] { return m_finished; });
+}
+
+template <typename result_t>
+template <typename rep, typename period>
+bool task_state<result_t>::wait_for(const std::chrono::duration<rep, period>& timeout) const
+{
+	std::unique_lock<std::mutex> _(m_lock);
+	return m_ready.wait_for(_, timeout, [this] { return m_finished; });
+}
+
+template <typename result_t>
+typename task_state<result_t>::storage_type& task_state<result_t>::value()
+{
+	std::lock_guard<std::mutex> _(m_lock);
+	if (m_error)
+	{
+		std::rethrow_exception(m_error);
+	}
+	if (!m_value.has_value())
+	{
+		throw std::future_error(std::future_errc::broken_promise);
+	}
+	return *m_value;
+}
+
+template <typename result_t>
+template <typename... arguments>
+void task_state<result_t>::set_value(arguments&&... value)
+{
+	std::unique_lock<std::mutex> _(m_lock);
+	if (m_finished)
+	{
+		throw std::future_error(std::future_errc::promise_already_satisfied);
+	}
+	if constexpr (std::is_void_v<result_t>)
+	{
+		m_value.emplace(true);
+	}
+	else
+	{
+		m_value.emplace(std::forward<arguments>(value)...);
+	}
+	finish(_);
+}
+
+template <typename result_t>
+void task_state<result_t>::set_exception(std::exception_ptr error)
+{
+	std::unique_lock<std::mutex> _(m_lock);
+	if (m_finished)
+	{
+		throw std::future_error(std::future_errc::promise_already_satisfied);
+	}
+	m_error = std::move(error);
+	finish(_);
+}
+
+template <typename result_t>
+void task_state<result_t>::abandon()
+{
+	std::unique_lock<std::mutex> _(m_lock);
+	if (!m_finished)
+	{
+		m_error = abandon_reason::current();
+		finish(_);
+	}
+}
+
+template <typename result_t>
+void task_state<result_t>::on_ready(std::function<void()> continuation)
+{
+	{
+		std::lock_guard<std::mutex> _(m_lock);
+		if (!m_finished)
+		{
+			m_continuations.push_back(std::move(continuation));
+			return;
+		}
+	}
+	continuation();
+}
+
+template <typename result_t>
+void task_state<result_t>::finish(std::unique_lock<std::mutex>& lock)
+{
+	m_finished = true;
+	std::vector<std::function<void()>> continuations;
+	continuations.swap(m_continuations);
+	lock.unlock();
+	m_ready.notify_all();
+	for (std::function<void()>& continuation : continuations)
+	{
+		continuation();
+	}
+}
+
+template <typename result_t>
+task_promise<result_t>& task_promise<result_t>::operator=(task_promise&& rhs) noexcept
+{
+	if (this != &rhs)
+	{
+		release();
+		m_state = std::move(rhs.m_state);
+	}
+	return *this;
+}
+
+// Rethrows the task's exception, or throws std::future_error if the task was
+// destroyed without running (task_dropped if the pool evicted it).
+template <typename result_t>
+result_t task_future<result_t>::get()
+{
+	m_state->wait();
+	if constexpr (std::is_void_v<result_t>)
+	{
+		m_state->value();
+	}
+	else
+	{
+		return std::move(m_state->value());
+	}
+}
+
+// The continuation runs on the thread that completes this future, or right
+// away on the caller's thread if it is already complete. If this future is
+// broken, so is the one returned; an exception, whether this future holds one
+// or the continuation throws it, is passed on to the one returned.
+template <typename result_t>
+template <typename continuation_t>
+task_future<typename task_future<result_t>::template continuation_result<continuation_t>> task_future<result_t>::then(continuation_t&& continuation)
+{
+	using next_t = continuation_result<continuation_t>;
+	auto next = std::make_shared<task_promise<next_t>>();
+	task_future<next_t> future = next->get_future();
+	task_state<result_t>* state = m_state.get();
+	m_state->on_ready([state, next, continuation = std::forward<continuation_t>(continuation)]() mutable {
+		if (std::exception_ptr error = state->error())
+		{
+			next->set_exception(std::move(error));
+			return;
+		}
+		if (!state->has_value())
+		{
+			return;
+		}
+		try
+		{
+			if constexpr (std::is_void_v<result_t> && std::is_void_v<next_t>)
+			{
+				continuation();
+				next->set_value();
+			}
+			else if constexpr (std::is_void_v<result_t>)
+			{
+				next->set_value(continuation());
+			}
+			else if constexpr (std::is_void_v<next_t>)
+			{
+				continuation(state->value());
+				next->set_value();
+			}
+			else
+			{
+				next->set_value(continuation(state->value()));
+			}
+		}
+		catch (...)
+		{
+			next->set_exception(std::current_exception());
+		}
+	});
+	return future;
+}
@@ -0,0 +1,288 @@
+#pragma once
+#include "thread_pool.h"
+#include <atomic>
+#include <exception>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+// Reusable DAG of tasks. Nodes are added with emplace() and ordered with
+// precede(); run() submits every node to the pool as soon as its last
+// predecessor finishes and returns a future that becomes ready when all nodes
+// have run. The structure is kept between runs, so a pipeline is built once
+// and run many times. The graph must not be changed or destroyed while a run
+// is in progress. A node that throws still counts as finished, so its
+// successors run; the run's future then rethrows the first exception. A node
+// the pool discards without running (drop_oldest, or a terminate_now() whose
+// caller destroys it) is skipped along with every node after it; the run
+// still waits for the other nodes and then fails with task_dropped, or with
+// std::runtime_error if the pool gave no reason.
+template <typename policy_t = default_pool_policy>
+class basic_task_graph
+{
+	struct node
+	{
+		move_only_task<void()> work;
+		std::vector<size_t> successors;
+		size_t predecessor_count = 0;
+		std::atomic<size_t> pending = 0;
+		// Set by a predecessor that did not run; read once pending is 0.
+		std::atomic<bool> skipped = false;
+	};
+	// Submitted to the pool for a ready node. Destroyed without running, it
+	// skips the node.
+	struct node_launch
+	{
+		basic_task_graph* graph;
+		node* target;
+		inline node_launch(basic_task_graph* owner, node* ready) : graph(owner), target(ready) {}
+		inline node_launch(node_launch&& other) noexcept : graph(std::exchange(other.graph, nullptr)), target(other.target) {}
+		inline ~node_launch() { if (graph != nullptr) { graph->abandon(target); } }
+		inline size_t operator()() { std::exchange(graph, nullptr)->execute(target); return 0; }
+		node_launch& operator=(node_launch&& rhs) = delete;
+	};
+public:
+	inline basic_task_graph() = default;
+	template <typename task_t>
+	inline size_t emplace(task_t&& task);
+	inline void precede(const size_t before, const size_t after);
+	inline size_t size() const { return m_nodes.size(); }
+	inline task_future<void> run(basic_thread_pool<policy_t>& pool);
+public:
+	basic_task_graph(const basic_task_graph& other) = delete;
+	basic_task_graph(basic_task_graph&& other) = delete;
+	basic_task_graph& operator=(const basic_task_graph& rhs) = delete;
+	basic_task_graph& operator=(basic_task_graph&& rhs) = delete;
+private:
+	inline void validate() const;
+	inline void schedule(node* ready);
+	inline void execute(node* current);
+	inline void finish();
+	inline void abandon(node* dropped);
+	std::vector<std::unique_ptr<node>> m_nodes;
+	basic_thread_pool<policy_t>* m_pool = nullptr;
+	task_promise<void> m_finished;
+	std::atomic<size_t> m_remaining = 0;
+	std::atomic<bool> m_running = false;
+	std::atomic<bool> m_failed = false;
+	std::exception_ptr m_error;
+	bool m_validated = false;
+};
+
+using task_graph = basic_task_graph<default_pool_policy>;
+
+// Returns the node's index, used with precede().
+template <typename policy_t>
+template <typename task_t>
+size_t basic_task_graph<policy_t>::emplace(task_t&& task)
+{
+	m_nodes.emplace_back(new node);
+	m_nodes.back()->work = std::forward<task_t>(task);
+	return m_nodes.size() - 1;
+}
+
+// after runs only once before has finished.
+template <typename policy_t>
+void basic_task_graph<policy_t>::precede(const size_t before, const size_t after)
+{
+	if (before >= m_nodes.size() || after >= m_nodes.size())
+	{
+		throw std::out_of_range("task_graph::precede: no such node");
+	}
+	m_nodes[before]->successors.push_back(after);
+	m_nodes[after]->predecessor_count++;
+	m_validated = false;
+}
+
+// Throws std::invalid_argument if the graph has a cycle and std::logic_error
+// if the previous run has not finished.
+template <typename policy_t>
+task_future<void> basic_task_graph<policy_t>::run(basic_thread_pool<policy_t>& pool)
+{
+	if (m_running.exchange(true))
+	{
+		throw std::logic_error("task_graph::run: previous run has not finished");
+	}
+	if (!m_validated)
+	{
+		try
+		{
+			validate();
+		}
+		catch (...)
+		{
+			m_running = false;
+			throw;
+		}
+		m_validated = true;
+	}
+	m_pool = &pool;
+	m_finished = task_promise<void>();
+	task_future<void> future = m_finished.get_future();
+	m_failed = false;
+	m_error = nullptr;
+	if (m_nodes.empty())
+	{
+		finish();
+		return future;
+	}
+	for (std::unique_ptr<node>& current : m_nodes)
+	{
+		current->pending.store(current->predecessor_count, std::memory_order_relaxed);
+		current->skipped.store(false, std::memory_order_relaxed);
+	}
+	m_remaining.store(m_nodes.size(), std::memory_order_release);
+	for (std::unique_ptr<node>& current : m_nodes)
+	{
+		if (current->predecessor_count == 0)
+		{
+			schedule(current.get());
+		}
+	}
+	return future;
+}
+
+// Kahn's algorithm: a cycle leaves nodes that never reach zero predecessors.
+template <typename policy_t>
+void basic_task_graph<policy_t>::validate() const
+{
+	std::vector<size_t> pending(m_nodes.size());
+	std::vector<size_t> ready;
+	for (size_t index = 0; index < m_nodes.size(); index++)
+	{
+		pending[index] = m_nodes[index]->predecessor_count;
+		if (pending[index] == 0)
+		{
+			ready.push_back(index);
+		}
+	}
+	size_t visited = 0;
+	while (!ready.empty())
+	{
+		size_t index = ready.back();
+		ready.pop_back();
+		visited++;
+		for (size_t successor : m_nodes[index]->successors)
+		{
+			if (--pending[successor] == 0)
+			{
+				ready.push_back(successor);
+			}
+		}
+	}
+	if (visited != m_nodes.size())
+	{
+		throw std::invalid_argument("task_graph::run: graph has a cycle");
+	}
+}
+
+// A pool that no longer takes tasks (it is terminating) leaves the rest of
+// the run to the calling thread.
+template <typename policy_t>
+void basic_task_graph<policy_t>::schedule(node* ready)
+{
+	node_launch launch(this, ready);
+	if (m_pool->add_task(std::move(launch)) == size_t(-1))
+	{
+		launch.graph = nullptr;
+		execute(ready);
+	}
+}
+
+// Runs current, then keeps one of the successors it made ready on this
+// thread and submits the others. A skipped node does not run and skips its
+// successors; those are never submitted, but counted off here.
+template <typename policy_t>
+void basic_task_graph<policy_t>::execute(node* current)
+{
+	std::vector<node*> skipped;
+	while (current != nullptr)
+	{
+		bool runs = !current->skipped.load(std::memory_order_relaxed);
+		if (runs)
+		{
+			try
+			{
+				current->work();
+			}
+			catch (...)
+			{
+				if (!m_failed.exchange(true, std::memory_order_relaxed))
+				{
+					m_error = std::current_exception();
+				}
+			}
+		}
+		node* next = nullptr;
+		for (size_t successor : current->successors)
+		{
+			node* ready = m_nodes[successor].get();
+			if (!runs)
+			{
+				ready->skipped.store(true, std::memory_order_relaxed);
+			}
+			if (ready->pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+			{
+				if (ready->skipped.load(std::memory_order_relaxed))
+				{
+					skipped.push_back(ready);
+				}
+				else if (next == nullptr)
+				{
+					next = ready;
+				}
+				else
+				{
+					schedule(ready);
+				}
+			}
+		}
+		if (m_remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+		{
+			finish();
+			return;
+		}
+		if (next == nullptr && !skipped.empty())
+		{
+			next = skipped.back();
+			skipped.pop_back();
+		}
+		current = next;
+	}
+}
+
+// The promise is moved out before the graph is released, since a waiter may
+// call run() again as soon as m_running is cleared.
+template <typename policy_t>
+void basic_task_graph<policy_t>::finish()
+{
+	task_promise<void> finished = std::move(m_finished);
+	std::exception_ptr error = std::move(m_error);
+	m_running = false;
+	if (error)
+	{
+		finished.set_exception(std::move(error));
+	}
+	else
+	{
+		finished.set_value();
+	}
+}
+
+// The run fails with the reason the pool gave for discarding the node, if
+// it runs under an abandon_reason.
+template <typename policy_t>
+void basic_task_graph<policy_t>::abandon(node* dropped)
+{
+	if (!m_failed.exchange(true, std::memory_order_relaxed))
+	{
+		m_error = abandon_reason::current();
+		if (!m_error)
+		{
+			m_error = std::make_exception_ptr(std::runtime_error("task_graph: node discarded by the pool without running"));
+		}
+	}
+	dropped->skipped.store(true, std::memory_order_relaxed);
+	execute(dropped);
+}
@@ -0,0 +1,137 @@
+#pragma once
+#include "thread_pool.h"
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <stop_token>
+#include <type_traits>
+#include <utility>
+
+// A set of tasks submitted to a long-lived pool that can be joined or
+// cancelled as a unit. Tasks take either no arguments or a std::stop_token.
+// cancel() makes queued tasks of the group skip their body when a worker
+// reaches them and requests stop on the token running tasks were given.
+// Skipped tasks keep their place in the pool's queue, and count against its
+// capacity, until then. Cancellation is final: run() refuses new tasks
+// afterwards, so a group that is to start over is replaced. The destructor
+// waits for the group. A task that throws still counts as
+// finished; the exception goes to the pool's error handler.
+template <typename policy_t = default_pool_policy>
+class basic_task_group
+{
+	struct group_state
+	{
+		std::stop_source stop;
+		std::atomic<size_t> outstanding = 0;
+		std::mutex lock;
+		std::condition_variable finished;
+		inline void finish_one();
+	};
+	// Counts as finished when run or when the pool drops it unrun.
+	template <typename function_t>
+	struct group_task
+	{
+		std::shared_ptr<group_state> state;
+		function_t function;
+		inline group_task(std::shared_ptr<group_state> owner, function_t&& body) : state(std::move(owner)), function(std::move(body)) {}
+		inline group_task(group_task&& other) noexcept = default;
+		inline ~group_task() { if (state) { state->finish_one(); } }
+		inline size_t operator()();
+		group_task& operator=(group_task&& rhs) = delete;
+	};
+public:
+	inline explicit basic_task_group(basic_thread_pool<policy_t>& pool) : m_pool(pool), m_state(std::make_shared<group_state>()) {}
+	inline ~basic_task_group() { wait(); }
+	template <typename task_t>
+	inline size_t run(task_t&& task) { return run(task_priority::normal, std::forward<task_t>(task)); }
+	template <typename task_t>
+	inline size_t run(task_priority priority, task_t&& task);
+	inline void wait();
+	inline void cancel() { m_state->stop.request_stop(); }
+	inline bool cancelled() const { return m_state->stop.stop_requested(); }
+	inline std::stop_token stop_token() const { return m_state->stop.get_token(); }
+public:
+	basic_task_group(const basic_task_group& other) = delete;
+	basic_task_group(basic_task_group&& other) = delete;
+	basic_task_group& operator=(const basic_task_group& rhs) = delete;
+	basic_task_group& operator=(basic_task_group&& rhs) = delete;
+private:
+	basic_thread_pool<policy_t>& m_pool;
+	std::shared_ptr<group_state> m_state;
+};
+
+using task_group = basic_task_group<default_pool_policy>;
+
+template <typename policy_t>
+void basic_task_group<policy_t>::group_state::finish_one()
+{
+	if (outstanding.fetch_sub(1, std::memory_order_acq_rel) == 1)
+	{
+		std::lock_guard<std::mutex> _(lock);
+		finished.notify_all();
+	}
+}
+
+template <typename policy_t>
+template <typename function_t>
+size_t basic_task_group<policy_t>::group_task<function_t>::operator()()
+{
+	std::shared_ptr<group_state> owner = std::move(state);
+	struct finished { group_state& state; ~finished() { state.finish_one(); } } _{ *owner };
+	size_t result = 0;
+	if (!owner->stop.stop_requested())
+	{
+		if constexpr (std::is_invocable_v<function_t&, std::stop_token>)
+		{
+			using result_t = std::invoke_result_t<function_t&, std::stop_token>;
+			if constexpr (std::is_convertible_v<result_t, size_t>) {
+				result = std::invoke(function, owner->stop.get_token());
+			}
+			else {
+				std::invoke(function, owner->stop.get_token());
+			}
+		}
+		else
+		{
+			using result_t = std::invoke_result_t<function_t&>;
+			if constexpr (std::is_convertible_v<result_t, size_t>) {
+				result = std::invoke(function);
+			}
+			else {
+				std::invoke(function);
+			}
+		}
+	}
+	return result;
+}
+
+// Returns the pool's task id, or -1 if the pool does not take tasks or the
+// group was cancelled.
+template <typename policy_t>
+template <typename task_t>
+size_t basic_task_group<policy_t>::run(task_priority priority, task_t&& task)
+{
+	if (m_state->stop.stop_requested())
+	{
+		return -1;
+	}
+	m_state->outstanding.fetch_add(1, std::memory_order_relaxed);
+	group_task<std::decay_t<task_t>> wrapped(m_state, std::decay_t<task_t>(std::forward<task_t>(task)));
+	// add_task() leaves a task it refuses unmoved, so wrapped's destructor then
+	// takes it off the count.
+	return m_pool.add_task(priority, std::move(wrapped));
+}
+
+// Runs other tasks meanwhile when called from one of the pool's workers.
+template <typename policy_t>
+void basic_task_group<policy_t>::wait()
+{
+	if (m_pool.in_worker_thread())
+	{
+		m_pool.wait_until([this] { return m_state->outstanding.load(std::memory_order_acquire) == 0; });
+		return;
+	}
+	std::unique_lock<std::mutex> _(m_state->lock);
+	m_state->finished.wait(_, [this] { return m_state->outstanding.load(std::memory_order_acquire) == 0; });
+}
@@ -1,6 +1,16 @@
 #pragma once
 
+#include "cache_line.h"
 #include <queue>
+#include <deque>
+#include <algorithm>
+#include <concepts>
+#include <atomic>
+#include <memory>
+#include <cstddef>
+#include <iterator>
+#include <vector>
+#include <mutex>
 #include <thread>
 #include <shared_mutex>
 
@@ -8,21 +18,81 @@ using read_write_lock = std::shared_mutex;
 using read_lock = std::shared_lock<read_write_lock>;
 using write_lock = std::unique_lock<read_write_lock>;
 
-template <typename task_type_t>
+struct unbounded_locked {};
+
+template <size_t capacity>
+struct bounded_lockfree {};
+
+template <size_t levels>
+struct priority_levels {};
+
+// What thread_pool needs from its shared queue, so the backend can be swapped
+// in one place. The queue is the only synchronization on the dequeue path:
+// the remaining-reporting pop() and pop_batch() return the depth they leave
+// behind from inside their own critical section, and the pool takes no lock
+// of its own around them. Enqueue likewise takes only the queue's lock.
+// Wakeups do not go through the queue at all; see thread_pool::idle_wait().
+// Every backend provides the priority calls; a single-level one ignores the
+// level and the aging step, and its lowest task is simply the oldest. bound
+// is the most tasks the queue holds, 0 if it grows as needed; the pool admits
+// no more than that, so it never waits on the queue itself.
+template <typename queue_t, typename task_type_t>
+concept pool_queue = requires(queue_t& queue, const queue_t& view, task_type_t& task, size_t& id, std::vector<task_type_t>& tasks, std::vector<size_t>& ids, std::vector<typename queue_t::reserved_task>& reserved)
+{
+	{ queue.pop(task, id, id) } -> std::same_as<bool>;
+	{ queue.pop_batch(tasks, ids, size_t(), size_t(), id) } -> std::same_as<size_t>;
+	{ queue.pop_lowest(task, id) } -> std::same_as<bool>;
+	{ queue.emplace_prioritized(size_t(), std::move(task)) } -> std::same_as<size_t>;
+	{ queue.emplace_range(tasks.begin(), tasks.end()) } -> std::same_as<size_t>;
+	queue.emplace_reserved(reserved);
+	queue.set_aging_step(size_t());
+	{ queue.reserve_id(size_t()) } -> std::same_as<size_t>;
+	{ view.size() } -> std::same_as<size_t>;
+	{ view.task_count() } -> std::same_as<size_t>;
+	{ queue_t::bound } -> std::convertible_to<size_t>;
+};
+
+// allocator_t backs the queue's own storage, e.g. slab_allocator<task_type_t>
+// to keep a node allocated on the producer from being freed into the global
+// heap by the consumer. bounded_lockfree preallocates and ignores it.
+template <typename task_type_t, typename backend_t = unbounded_locked, typename allocator_t = std::allocator<task_type_t>>
 class task_queue
 {
-	using task_queue_implementation = std::queue<task_type_t>;
+	template <typename value_type_t>
+	using rebound = typename std::allocator_traits<allocator_t>::template rebind_alloc<value_type_t>;
+	using task_queue_implementation = std::queue<task_type_t, std::deque<task_type_t, rebound<task_type_t>>>;
+public:
+	static constexpr size_t bound = 0;
+	// A task whose id was taken with reserve_id() when it was created. level
+	// is ignored: there is only one.
+	struct reserved_task
+	{
+		task_type_t task;
+		size_t id;
+		size_t level;
+	};
 public:
 	inline task_queue() = default;
 	inline ~task_queue() { clear(); }
 	inline bool empty() const;
 	inline size_t size() const;
-	inline size_t task_count();
+	inline size_t task_count() const;
+	inline size_t reserve_id(const size_t count = 1);
+	inline void set_aging_step(const size_t) {}
 public:
-	inline void clear();
+	inline size_t clear();
 	inline bool pop(task_type_t& task, size_t& id);
+	inline bool pop(task_type_t& task, size_t& id, size_t& remaining);
+	inline size_t pop_batch(std::vector<task_type_t>& tasks, std::vector<size_t>& ids, const size_t max_count, const size_t share = 1);
+	inline size_t pop_batch(std::vector<task_type_t>& tasks, std::vector<size_t>& ids, const size_t max_count, const size_t share, size_t& remaining);
 	template <typename... arguments>
 	inline size_t emplace(arguments&&... parameters);
+	template <typename... arguments>
+	inline size_t emplace_prioritized(const size_t, arguments&&... parameters) { return emplace(std::forward<arguments>(parameters)...); }
+	template <typename iterator_t>
+	inline size_t emplace_range(iterator_t first, iterator_t last);
+	inline void emplace_reserved(std::vector<reserved_task>& tasks);
+	inline bool pop_lowest(task_type_t& task, size_t& id) { return pop(task, id); }
 public:
 	task_queue(const task_queue& other) = delete;
 	task_queue(task_queue&& other) = delete;
@@ -31,47 +101,64 @@ public:
 private:
 	mutable read_write_lock m_rw_lock;
 	task_queue_implementation m_tasks;
-	std::queue<size_t> m_ids;
-	size_t tasks_total = 0;
+	std::queue<size_t, std::deque<size_t, rebound<size_t>>> m_ids;
+	std::atomic<size_t> tasks_total = 0;
 };
 
-template <typename task_type_t>
-bool task_queue<task_type_t>::empty() const
+template <typename task_type_t, typename backend_t, typename allocator_t>
+bool task_queue<task_type_t, backend_t, allocator_t>::empty() const
 {
 	read_lock _(m_rw_lock);
 	return m_tasks.empty();
 }
 
-template <typename task_type_t>
-size_t task_queue<task_type_t>::size() const
+template <typename task_type_t, typename backend_t, typename allocator_t>
+size_t task_queue<task_type_t, backend_t, allocator_t>::size() const
 {
 	read_lock _(m_rw_lock);
 	return m_tasks.size();
 }
 
-template<typename task_type_t>
-inline size_t task_queue<task_type_t>::task_count()
+template <typename task_type_t, typename backend_t, typename allocator_t>
+inline size_t task_queue<task_type_t, backend_t, allocator_t>::task_count() const
+{
+	return tasks_total.load(std::memory_order_relaxed);
+}
+
+template <typename task_type_t, typename backend_t, typename allocator_t>
+inline size_t task_queue<task_type_t, backend_t, allocator_t>::reserve_id(const size_t count)
 {
-	return tasks_total;
+	return tasks_total.fetch_add(count, std::memory_order_relaxed);
 }
 
-template <typename task_type_t>
-void task_queue<task_type_t>::clear()
+template <typename task_type_t, typename backend_t, typename allocator_t>
+size_t task_queue<task_type_t, backend_t, allocator_t>::clear()
 {
 	write_lock _(m_rw_lock);
+	size_t removed = m_tasks.size();
 	while (!m_tasks.empty())
 	{
 		m_tasks.pop();
 		m_ids.pop();
 	}
+	return removed;
+}
+
+template <typename task_type_t, typename backend_t, typename allocator_t>
+bool task_queue<task_type_t, backend_t, allocator_t>::pop(task_type_t& task, size_t& id)
+{
+	size_t remaining = 0;
+	return pop(task, id, remaining);
 }
 
-template <typename task_type_t>
-bool task_queue<task_type_t>::pop(task_type_t& task, size_t& id)
+// remaining is the size left behind, read under the same lock as the pop.
+template <typename task_type_t, typename backend_t, typename allocator_t>
+bool task_queue<task_type_t, backend_t, allocator_t>::pop(task_type_t& task, size_t& id, size_t& remaining)
 {
 	write_lock _(m_rw_lock);
 	if (m_tasks.empty())
 	{
+		remaining = 0;
 		return false;
 	}
 	else
@@ -80,18 +167,605 @@ bool task_queue<task_type_t>::pop(task_type_t& task, size_t& id)
 		id = std::move(m_ids.front());
 		m_tasks.pop();
 		m_ids.pop();
+		remaining = m_tasks.size();
 		return true;
 	}
 }
 
-template <typename task_type_t>
+template <typename task_type_t, typename backend_t, typename allocator_t>
 template <typename... arguments>
-size_t task_queue<task_type_t>::emplace(arguments&&... parameters)
+size_t task_queue<task_type_t, backend_t, allocator_t>::emplace(arguments&&... parameters)
 {
 	write_lock _(m_rw_lock);
-	size_t id = tasks_total;
+	size_t id = reserve_id();
 	m_tasks.emplace(std::forward<arguments>(parameters)...);
 	m_ids.push(id);
-	tasks_total++;
 	return id;
 }
+
+// Appends up to size() / share tasks, at least one and at most max_count, to
+// tasks and ids under one lock. share is typically the number of consumers so
+// a single pop does not take more than its fair part of the queue.
+template <typename task_type_t, typename backend_t, typename allocator_t>
+size_t task_queue<task_type_t, backend_t, allocator_t>::pop_batch(std::vector<task_type_t>& tasks, std::vector<size_t>& ids, const size_t max_count, const size_t share)
+{
+	size_t remaining = 0;
+	return pop_batch(tasks, ids, max_count, share, remaining);
+}
+
+template <typename task_type_t, typename backend_t, typename allocator_t>
+size_t task_queue<task_type_t, backend_t, allocator_t>::pop_batch(std::vector<task_type_t>& tasks, std::vector<size_t>& ids, const size_t max_count, const size_t share, size_t& remaining)
+{
+	write_lock _(m_rw_lock);
+	size_t count = std::min(std::max<size_t>(m_tasks.size() / share, 1), std::min(max_count, m_tasks.size()));
+	for (size_t index = 0; index < count; index++)
+	{
+		tasks.push_back(std::move(m_tasks.front()));
+		ids.push_back(m_ids.front());
+		m_tasks.pop();
+		m_ids.pop();
+	}
+	remaining = m_tasks.size();
+	return count;
+}
+
+// Moves every element of [first, last) into the queue under one lock and
+// returns the first id; the batch gets consecutive ids.
+template <typename task_type_t, typename backend_t, typename allocator_t>
+template <typename iterator_t>
+size_t task_queue<task_type_t, backend_t, allocator_t>::emplace_range(iterator_t first, iterator_t last)
+{
+	size_t count = std::distance(first, last);
+	write_lock _(m_rw_lock);
+	size_t id = reserve_id(count);
+	for (size_t index = 0; first != last; ++first, index++)
+	{
+		m_tasks.emplace(std::move(*first));
+		m_ids.push(id + index);
+	}
+	return id;
+}
+
+// Moves every task out of tasks under one lock; they keep their ids.
+template <typename task_type_t, typename backend_t, typename allocator_t>
+void task_queue<task_type_t, backend_t, allocator_t>::emplace_reserved(std::vector<reserved_task>& tasks)
+{
+	write_lock _(m_rw_lock);
+	for (reserved_task& reserved : tasks)
+	{
+		m_tasks.emplace(std::move(reserved.task));
+		m_ids.push(reserved.id);
+	}
+}
+
+// Bounded multi-producer/multi-consumer ring buffer (D. Vyukov). Each task is
+// stored with its id in one cache-line-aligned slot, so neither emplace() nor
+// pop() takes a lock or allocates.
+template <typename task_type_t, size_t capacity, typename allocator_t>
+class task_queue<task_type_t, bounded_lockfree<capacity>, allocator_t>
+{
+	struct alignas(cache_line_size) slot
+	{
+		std::atomic<size_t> sequence;
+		size_t id;
+		alignas(task_type_t) unsigned char storage[sizeof(task_type_t)];
+		inline task_type_t* task() { return reinterpret_cast<task_type_t*>(storage); }
+	};
+	static_assert(capacity >= 2 && (capacity & (capacity - 1)) == 0, "bounded_lockfree capacity must be a power of two");
+	static constexpr size_t mask = capacity - 1;
+public:
+	// emplace() waits for a slot once this many tasks are queued.
+	static constexpr size_t bound = capacity;
+	// A task whose id was taken with reserve_id() when it was created. level
+	// is ignored: there is only one.
+	struct reserved_task
+	{
+		task_type_t task;
+		size_t id;
+		size_t level;
+	};
+public:
+	inline task_queue();
+	inline ~task_queue() { clear(); }
+	inline bool empty() const;
+	inline size_t size() const;
+	inline size_t task_count() const;
+	inline size_t reserve_id(const size_t count = 1);
+	inline void set_aging_step(const size_t) {}
+public:
+	inline size_t clear();
+	inline bool pop(task_type_t& task, size_t& id);
+	inline bool pop(task_type_t& task, size_t& id, size_t& remaining);
+	inline size_t pop_batch(std::vector<task_type_t>& tasks, std::vector<size_t>& ids, const size_t max_count, const size_t share = 1);
+	inline size_t pop_batch(std::vector<task_type_t>& tasks, std::vector<size_t>& ids, const size_t max_count, const size_t share, size_t& remaining);
+	template <typename... arguments>
+	inline size_t emplace(arguments&&... parameters);
+	template <typename... arguments>
+	inline size_t emplace_prioritized(const size_t, arguments&&... parameters) { return emplace(std::forward<arguments>(parameters)...); }
+	template <typename... arguments>
+	inline bool try_emplace(size_t& id, arguments&&... parameters);
+	template <typename iterator_t>
+	inline size_t emplace_range(iterator_t first, iterator_t last);
+	inline void emplace_reserved(std::vector<reserved_task>& tasks);
+	inline bool pop_lowest(task_type_t& task, size_t& id) { return pop(task, id); }
+public:
+	task_queue(const task_queue& other) = delete;
+	task_queue(task_queue&& other) = delete;
+	task_queue& operator=(const task_queue& rhs) = delete;
+	task_queue& operator=(task_queue&& rhs) = delete;
+private:
+	std::unique_ptr<slot[]> m_slots;
+	alignas(cache_line_size) std::atomic<size_t> m_enqueue_pos = 0;
+	alignas(cache_line_size) std::atomic<size_t> m_dequeue_pos = 0;
+	alignas(cache_line_size) std::atomic<size_t> tasks_total = 0;
+private:
+	inline slot* claim(size_t& pos);
+	template <typename... arguments>
+	inline void publish(slot* target, const size_t pos, const size_t id, arguments&&... parameters);
+};
+
+template <typename task_type_t, size_t capacity, typename allocator_t>
+task_queue<task_type_t, bounded_lockfree<capacity>, allocator_t>::task_queue() : m_slots(new slot[capacity])
+{
+	for (size_t index = 0; index < capacity; index++)
+	{
+		m_slots[index].sequence.store(index, std::memory_order_relaxed);
+	}
+}
+
+template <typename task_type_t, size_t capacity, typename allocator_t>
+bool task_queue<task_type_t, bounded_lockfree<capacity>, allocator_t>::empty() const
+{
+	return size() == 0;
+}
+
+template <typename task_type_t, size_t capacity, typename allocator_t>
+size_t task_queue<task_type_t, bounded_lockfree<capacity>, allocator_t>::size() const
+{
+	size_t dequeue_pos = m_dequeue_pos.load(std::memory_order_relaxed);
+	size_t enqueue_pos = m_enqueue_pos.load(std::memory_order_relaxed);
+	return enqueue_pos > dequeue_pos ? enqueue_pos - dequeue_pos : 0;
+}
+
+template <typename task_type_t, size_t capacity, typename allocator_t>
+size_t task_queue<task_type_t, bounded_lockfree<capacity>, allocator_t>::task_count() const
+{
+	return tasks_total.load(std::memory_order_relaxed);
+}
+
+template <typename task_type_t, size_t capacity, typename allocator_t>
+size_t task_queue<task_type_t, bounded_lockfree<capacity>, allocator_t>::reserve_id(const size_t count)
+{
+	return tasks_total.fetch_add(count, std::memory_order_relaxed);
+}
+
+template <typename task_type_t, size_t capacity, typename allocator_t>
+size_t task_queue<task_type_t, bounded_lockfree<capacity>, allocator_t>::clear()
+{
+	size_t removed = 0;
+	task_type_t task;
+	size_t id;
+	while (pop(task, id))
+	{
+		removed++;
+	}
+	return removed;
+}
+
+template <typename task_type_t, size_t capacity, typename allocator_t>
+bool task_queue<task_type_t, bounded_lockfree<capacity>, allocator_t>::pop(task_type_t& task, size_t& id, size_t& remaining)
+{
+	bool popped = pop(task, id);
+	remaining = size();
+	return popped;
+}
+
+template <typename task_type_t, size_t capacity, typename allocator_t>
+bool task_queue<task_type_t, bounded_lockfree<capacity>, allocator_t>::pop(task_type_t& task, size_t& id)
+{
+	size_t pos = m_dequeue_pos.load(std::memory_order_relaxed);
+	slot* target = nullptr;
+	while (true)
+	{
+		target = &m_slots[pos & mask];
+		size_t sequence = target->sequence.load(std::memory_order_acquire);
+		std::ptrdiff_t difference = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(pos + 1);
+		if (difference == 0)
+		{
+			if (m_dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+			{
+				break;
+			}
+		}
+		else if (difference < 0)
+		{
+			return false;
+		}
+		else
+		{
+			pos = m_dequeue_pos.load(std::memory_order_relaxed);
+		}
+	}
+	task = std::move(*target->task());
+	id = target->id;
+	target->task()->~task_type_t();
+	target->sequence.store(pos + capacity, std::memory_order_release);
+	return true;
+}
+
+template <typename task_type_t, size_t capacity, typename allocator_t>
+typename task_queue<task_type_t, bounded_lockfree<capacity>, allocator_t>::slot* task_queue<task_type_t, bounded_lockfree<capacity>, allocator_t>::claim(size_t& pos)
+{
+	pos = m_enqueue_pos.load(std::memory_order_relaxed);
+	while (true)
+	{
+		slot* target = &m_slots[pos & mask];
+		size_t sequence = target->sequence.load(std::memory_order_acquire);
+		std::ptrdiff_t difference = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(pos);
+		if (difference == 0)
+		{
+			if (m_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+			{
+				return target;
+			}
+		}
+		else if (difference < 0)
+		{
+			return nullptr;
+		}
+		else
+		{
+			pos = m_enqueue_pos.load(std::memory_order_relaxed);
+		}
+	}
+}
+
+template <typename task_type_t, size_t capacity, typename allocator_t>
+template <typename... arguments>
+void task_queue<task_type_t, bounded_lockfree<capacity>, allocator_t>::publish(slot* target, const size_t pos, const size_t id, arguments&&... parameters)
+{
+	new (target->storage) task_type_t(std::forward<arguments>(parameters)...);
+	target->id = id;
+	target->sequence.store(pos + 1, std::memory_order_release);
+}
+
+template <typename task_type_t, size_t capacity, typename allocator_t>
+template <typename... arguments>
+bool task_queue<task_type_t, bounded_lockfree<capacity>, allocator_t>::try_emplace(size_t& id, arguments&&... parameters)
+{
+	size_t pos = 0;
+	slot* target = claim(pos);
+	if (target == nullptr)
+	{
+		return false;
+	}
+	id = reserve_id();
+	publish(target, pos, id, std::forward<arguments>(parameters)...);
+	return true;
+}
+
+template <typename task_type_t, size_t capacity, typename allocator_t>
+template <typename... arguments>
+size_t task_queue<task_type_t, bounded_lockfree<capacity>, allocator_t>::emplace(arguments&&... parameters)
+{
+	// Blocking push: wait for a consumer to free a slot. parameters are only
+	// consumed by the successful attempt.
+	size_t id = 0;
+	while (!try_emplace(id, std::forward<arguments>(parameters)...))
+	{
+		std::this_thread::yield();
+	}
+	return id;
+}
+
+// Reserves the whole id range up front so the batch gets consecutive ids, then
+// blocks per element until a slot frees up.
+template <typename task_type_t, size_t capacity, typename allocator_t>
+template <typename iterator_t>
+size_t task_queue<task_type_t, bounded_lockfree<capacity>, allocator_t>::emplace_range(iterator_t first, iterator_t last)
+{
+	size_t count = std::distance(first, last);
+	size_t id = reserve_id(count);
+	for (size_t index = 0; first != last; ++first, index++)
+	{
+		size_t pos = 0;
+		slot* target = nullptr;
+		while ((target = claim(pos)) == nullptr)
+		{
+			std::this_thread::yield();
+		}
+		publish(target, pos, id + index, std::move(*first));
+	}
+	return id;
+}
+
+// Blocks per element until a slot frees up, like emplace_range().
+template <typename task_type_t, size_t capacity, typename allocator_t>
+void task_queue<task_type_t, bounded_lockfree<capacity>, allocator_t>::emplace_reserved(std::vector<reserved_task>& tasks)
+{
+	for (reserved_task& reserved : tasks)
+	{
+		size_t pos = 0;
+		slot* target = nullptr;
+		while ((target = claim(pos)) == nullptr)
+		{
+			std::this_thread::yield();
+		}
+		publish(target, pos, reserved.id, std::move(reserved.task));
+	}
+}
+
+template <typename task_type_t, size_t capacity, typename allocator_t>
+size_t task_queue<task_type_t, bounded_lockfree<capacity>, allocator_t>::pop_batch(std::vector<task_type_t>& tasks, std::vector<size_t>& ids, const size_t max_count, const size_t share)
+{
+	size_t count = std::min(std::max<size_t>(size() / share, 1), max_count);
+	size_t popped = 0;
+	task_type_t task;
+	size_t id = 0;
+	while (popped < count && pop(task, id))
+	{
+		tasks.push_back(std::move(task));
+		ids.push_back(id);
+		popped++;
+	}
+	return popped;
+}
+
+// Without a lock remaining is only a snapshot taken after the last pop.
+template <typename task_type_t, size_t capacity, typename allocator_t>
+size_t task_queue<task_type_t, bounded_lockfree<capacity>, allocator_t>::pop_batch(std::vector<task_type_t>& tasks, std::vector<size_t>& ids, const size_t max_count, const size_t share, size_t& remaining)
+{
+	size_t popped = pop_batch(tasks, ids, max_count, share);
+	remaining = size();
+	return popped;
+}
+
+// Multi-level FIFO: level 0 is served first. To keep low levels from starving,
+// the head of each level is promoted by one level for every aging_step tasks
+// enqueued since it arrived. Tasks emplaced without a level go to levels / 2.
+template <typename task_type_t, size_t levels, typename allocator_t>
+class task_queue<task_type_t, priority_levels<levels>, allocator_t>
+{
+	static_assert(levels > 0, "priority_levels needs at least one level");
+	struct entry
+	{
+		task_type_t task;
+		size_t id;
+		size_t ticket;
+	};
+	using level_queue = std::queue<entry, std::deque<entry, typename std::allocator_traits<allocator_t>::template rebind_alloc<entry>>>;
+public:
+	static constexpr size_t bound = 0;
+	static constexpr size_t default_level = levels / 2;
+	// A task whose id was taken with reserve_id() when it was created, e.g. a
+	// delayed task that is only queued once it is due.
+	struct reserved_task
+	{
+		task_type_t task;
+		size_t id;
+		size_t level;
+	};
+public:
+	inline task_queue() = default;
+	inline ~task_queue() { clear(); }
+	inline bool empty() const;
+	inline size_t size() const;
+	inline size_t task_count() const;
+	inline size_t reserve_id(const size_t count = 1);
+	inline void set_aging_step(const size_t step);
+public:
+	inline size_t clear();
+	inline bool pop(task_type_t& task, size_t& id);
+	inline bool pop(task_type_t& task, size_t& id, size_t& remaining);
+	inline size_t pop_batch(std::vector<task_type_t>& tasks, std::vector<size_t>& ids, const size_t max_count, const size_t share = 1);
+	inline size_t pop_batch(std::vector<task_type_t>& tasks, std::vector<size_t>& ids, const size_t max_count, const size_t share, size_t& remaining);
+	template <typename... arguments>
+	inline size_t emplace(arguments&&... parameters);
+	template <typename... arguments>
+	inline size_t emplace_prioritized(const size_t level, arguments&&... parameters);
+	template <typename iterator_t>
+	inline size_t emplace_range(iterator_t first, iterator_t last);
+	inline void emplace_reserved(std::vector<reserved_task>& tasks);
+	inline bool pop_lowest(task_type_t& task, size_t& id);
+public:
+	task_queue(const task_queue& other) = delete;
+	task_queue(task_queue&& other) = delete;
+	task_queue& operator=(const task_queue& rhs) = delete;
+	task_queue& operator=(task_queue&& rhs) = delete;
+private:
+	inline size_t next_level() const;
+	inline void pop_level(const size_t level, task_type_t& task, size_t& id);
+	mutable read_write_lock m_rw_lock;
+	level_queue m_levels[levels];
+	size_t m_size = 0;
+	size_t m_ticket = 0;
+	size_t m_aging_step = 64;
+	std::atomic<size_t> tasks_total = 0;
+};
+
+template <typename task_type_t, size_t levels, typename allocator_t>
+bool task_queue<task_type_t, priority_levels<levels>, allocator_t>::empty() const
+{
+	read_lock _(m_rw_lock);
+	return m_size == 0;
+}
+
+template <typename task_type_t, size_t levels, typename allocator_t>
+size_t task_queue<task_type_t, priority_levels<levels>, allocator_t>::size() const
+{
+	read_lock _(m_rw_lock);
+	return m_size;
+}
+
+template <typename task_type_t, size_t levels, typename allocator_t>
+size_t task_queue<task_type_t, priority_levels<levels>, allocator_t>::task_count() const
+{
+	return tasks_total.load(std::memory_order_relaxed);
+}
+
+template <typename task_type_t, size_t levels, typename allocator_t>
+size_t task_queue<task_type_t, priority_levels<levels>, allocator_t>::reserve_id(const size_t count)
+{
+	return tasks_total.fetch_add(count, std::memory_order_relaxed);
+}
+
+template <typename task_type_t, size_t levels, typename allocator_t>
+void task_queue<task_type_t, priority_levels<levels>, allocator_t>::set_aging_step(const size_t step)
+{
+	write_lock _(m_rw_lock);
+	m_aging_step = std::max<size_t>(step, 1);
+}
+
+template <typename task_type_t, size_t levels, typename allocator_t>
+size_t task_queue<task_type_t, priority_levels<levels>, allocator_t>::clear()
+{
+	write_lock _(m_rw_lock);
+	size_t removed = m_size;
+	for (level_queue& level : m_levels)
+	{
+		while (!level.empty())
+		{
+			level.pop();
+		}
+	}
+	m_size = 0;
+	return removed;
+}
+
+template <typename task_type_t, size_t levels, typename allocator_t>
+size_t task_queue<task_type_t, priority_levels<levels>, allocator_t>::next_level() const
+{
+	size_t best = levels;
+	std::ptrdiff_t best_rank = 0;
+	for (size_t level = 0; level < levels; level++)
+	{
+		if (m_levels[level].empty())
+		{
+			continue;
+		}
+		size_t age = m_ticket - m_levels[level].front().ticket;
+		std::ptrdiff_t rank = static_cast<std::ptrdiff_t>(level) - static_cast<std::ptrdiff_t>(age / m_aging_step);
+		if (best == levels || rank < best_rank)
+		{
+			best = level;
+			best_rank = rank;
+		}
+	}
+	return best;
+}
+
+template <typename task_type_t, size_t levels, typename allocator_t>
+void task_queue<task_type_t, priority_levels<levels>, allocator_t>::pop_level(const size_t level, task_type_t& task, size_t& id)
+{
+	entry& front = m_levels[level].front();
+	task = std::move(front.task);
+	id = front.id;
+	m_levels[level].pop();
+	m_size--;
+}
+
+template <typename task_type_t, size_t levels, typename allocator_t>
+bool task_queue<task_type_t, priority_levels<levels>, allocator_t>::pop(task_type_t& task, size_t& id)
+{
+	size_t remaining = 0;
+	return pop(task, id, remaining);
+}
+
+template <typename task_type_t, size_t levels, typename allocator_t>
+bool task_queue<task_type_t, priority_levels<levels>, allocator_t>::pop(task_type_t& task, size_t& id, size_t& remaining)
+{
+	write_lock _(m_rw_lock);
+	size_t level = next_level();
+	if (level == levels)
+	{
+		remaining = 0;
+		return false;
+	}
+	pop_level(level, task, id);
+	remaining = m_size;
+	return true;
+}
+
+template <typename task_type_t, size_t levels, typename allocator_t>
+size_t task_queue<task_type_t, priority_levels<levels>, allocator_t>::pop_batch(std::vector<task_type_t>& tasks, std::vector<size_t>& ids, const size_t max_count, const size_t share)
+{
+	size_t remaining = 0;
+	return pop_batch(tasks, ids, max_count, share, remaining);
+}
+
+template <typename task_type_t, size_t levels, typename allocator_t>
+size_t task_queue<task_type_t, priority_levels<levels>, allocator_t>::pop_batch(std::vector<task_type_t>& tasks, std::vector<size_t>& ids, const size_t max_count, const size_t share, size_t& remaining)
+{
+	write_lock _(m_rw_lock);
+	size_t count = std::min(std::max<size_t>(m_size / share, 1), std::min(max_count, m_size));
+	for (size_t index = 0; index < count; index++)
+	{
+		tasks.emplace_back();
+		ids.emplace_back();
+		pop_level(next_level(), tasks.back(), ids.back());
+	}
+	remaining = m_size;
+	return count;
+}
+
+template <typename task_type_t, size_t levels, typename allocator_t>
+template <typename... arguments>
+size_t task_queue<task_type_t, priority_levels<levels>, allocator_t>::emplace(arguments&&... parameters)
+{
+	return emplace_prioritized(default_level, std::forward<arguments>(parameters)...);
+}
+
+template <typename task_type_t, size_t levels, typename allocator_t>
+template <typename... arguments>
+size_t task_queue<task_type_t, priority_levels<levels>, allocator_t>::emplace_prioritized(const size_t level, arguments&&... parameters)
+{
+	write_lock _(m_rw_lock);
+	size_t id = reserve_id();
+	m_levels[std::min(level, levels - 1)].push(entry{ task_type_t(std::forward<arguments>(parameters)...), id, m_ticket++ });
+	m_size++;
+	return id;
+}
+
+template <typename task_type_t, size_t levels, typename allocator_t>
+template <typename iterator_t>
+size_t task_queue<task_type_t, priority_levels<levels>, allocator_t>::emplace_range(iterator_t first, iterator_t last)
+{
+	size_t count = std::distance(first, last);
+	write_lock _(m_rw_lock);
+	size_t id = reserve_id(count);
+	for (size_t index = 0; first != last; ++first, index++)
+	{
+		m_levels[default_level].push(entry{ task_type_t(std::move(*first)), id + index, m_ticket++ });
+	}
+	m_size += count;
+	return id;
+}
+
+// Moves every task out of tasks under one lock; they keep their ids.
+template <typename task_type_t, size_t levels, typename allocator_t>
+void task_queue<task_type_t, priority_levels<levels>, allocator_t>::emplace_reserved(std::vector<reserved_task>& tasks)
+{
+	write_lock _(m_rw_lock);
+	for (reserved_task& reserved : tasks)
+	{
+		m_levels[std::min(reserved.level, levels - 1)].push(entry{ std::move(reserved.task), reserved.id, m_ticket++ });
+	}
+	m_size += tasks.size();
+}
+
+// Takes the longest-waiting task of the least urgent non-empty level,
+// ignoring aging: the task a full queue can best afford to lose.
+template <typename task_type_t, size_t levels, typename allocator_t>
+bool task_queue<task_type_t, priority_levels<levels>, allocator_t>::pop_lowest(task_type_t& task, size_t& id)
+{
+	write_lock _(m_rw_lock);
+	for (size_t level = levels; level-- > 0; )
+	{
+		if (!m_levels[level].empty())
+		{
+			pop_level(level, task, id);
+			return true;
+		}
+	}
+	return false;
+}
@@ -1,268 +1,2848 @@
 #pragma once
 #include "task_queue.h"
+#include "work_stealing_deque.h"
+#include "task_future.h"
+#include "move_only_task.h"
+#include "status_table.h"
+#include "cpu_topology.h"
+#include "pool_metrics.h"
+#include "trace_logger.h"
+#include "timer_wheel.h"
+#include "slab_allocator.h"
 #include <vector>
 #include <functional>
-#include <unordered_map>
+#include <iostream>
+#include <random>
+#include <memory>
+#include <span>
+#include <string>
 #include <chrono>
+#include <concepts>
+#include <condition_variable>
+#include <coroutine>
+#include <exception>
+#include <type_traits>
+#include <variant>
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 
 using std::chrono::nanoseconds;
 using std::chrono::duration_cast;
 using std::chrono::high_resolution_clock;
 
-class thread_pool
+enum class scheduler_mode
+{
+	global_queue,
+	work_stealing
+};
+
+enum class worker_affinity
+{
+	none,
+	core,
+	numa_node
+};
+
+// core pins each worker to one logical CPU, taking the CPUs node by node;
+// numa_node spreads workers over the nodes in contiguous blocks and lets each
+// run anywhere on its node. In work_stealing mode every node that has workers
+// becomes a scheduler domain with its own injection queue, and workers only
+// steal across domains when their own domain is out of work.
+struct pool_config
+{
+	size_t worker_count = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+	bool debug_mode = false;
+	scheduler_mode mode = scheduler_mode::global_queue;
+	worker_affinity affinity = worker_affinity::none;
+	// Per-worker counters and latency histograms behind stats(); always on in
+	// debug mode. Costs one clock read per submit and two per task.
+	bool collect_metrics = true;
+};
+
+enum class task_priority : size_t
+{
+	high,
+	normal,
+	low
+};
+constexpr size_t task_priority_count = 3;
+
+// How an idle worker waits for work: spin_count polls with a CPU pause, then
+// yield_count polls with std::this_thread::yield(), then it parks on an
+// atomic wait until a producer wakes it.
+struct idle_policy
+{
+	size_t spin_count = 0;
+	size_t yield_count = 0;
+};
+
+// Bounds for an elastic pool; max_workers = 0 keeps the worker count fixed.
+// Otherwise a background thread looks at the load every check_interval: it
+// starts a worker when more than queue_depth tasks per worker are pending or
+// the mean queue wait over the last interval exceeded wait_threshold, and
+// retires one when some have stayed parked with nothing queued for
+// idle_timeout. worker_count is the starting size.
+struct elastic_policy
+{
+	size_t min_workers = 1;
+	size_t max_workers = 0;
+	size_t queue_depth = 4;
+	std::chrono::microseconds wait_threshold{ 1000 };
+	std::chrono::milliseconds check_interval{ 10 };
+	std::chrono::milliseconds idle_timeout{ 1000 };
+};
+
+// What a submit does when capacity tasks are already queued: wait for room
+// (on one of the pool's workers it runs the task itself instead, since
+// waiting there could deadlock the pool), fail, run the task on the
+// submitting thread, or evict the longest-waiting task of the least urgent
+// priority to make room.
+enum class overflow_policy
+{
+	block,
+	reject,
+	caller_runs,
+	drop_oldest
+};
+
+// capacity bounds the tasks queued for immediate execution; 0 leaves the
+// queue unbounded. A bounded queue backend caps it at its own size. A batch
+// that does not fit is queued as far as there is room under caller_runs,
+// and only the rest runs on the caller; under the other policies an empty
+// queue takes the whole batch, unless it is larger than a bounded backend,
+// which runs it on the caller under block and refuses it otherwise. Delayed
+// tasks count once they are due, and are never refused then.
+// on_high_watermark runs on the submitting thread when the queue reaches
+// high_watermark, on_low_watermark on a worker once it is back down to
+// low_watermark; each fires once per crossing. Both run only after the pool
+// lock is released, but on_low_watermark still runs on a worker, so it may
+// not wait for the pool to stop.
+struct backpressure_policy
+{
+	size_t capacity = 0;
+	overflow_policy overflow = overflow_policy::block;
+	size_t high_watermark = 0;
+	size_t low_watermark = 0;
+	std::function<void(size_t)> on_high_watermark;
+	std::function<void(size_t)> on_low_watermark;
+};
+
+enum class submit_status
+{
+	queued,
+	ran_on_caller,
+	queue_full,
+	stopped
+};
+
+// What try_add_task() did. id is the task's id when it was queued or run,
+// and -1 otherwise.
+struct submit_result
+{
+	submit_status status = submit_status::stopped;
+	size_t id = size_t(-1);
+	inline explicit operator bool() const { return status == submit_status::queued || status == submit_status::ran_on_caller; }
+};
+
+inline void cpu_relax()
+{
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+	_mm_pause();
+#else
+	std::this_thread::yield();
+#endif
+}
+
+// A task taken back out of the queues before any worker started it. It can
+// be passed to another pool's add_task() as is.
+struct unstarted_task
+{
+	size_t id;
+	task_priority priority;
+	move_only_task<size_t()> task;
+};
+
+struct drain_result
+{
+	// Every queued task ran and the workers have been joined.
+	bool completed = false;
+	// Workers still inside a task at the deadline; terminate() joins them.
+	size_t busy_workers = 0;
+	std::vector<unstarted_task> unstarted;
+};
+
+// What shutdown_async() returns: drained becomes ready at the drain deadline
+// or sooner, stopped once every worker has been joined.
+struct shutdown_handle
+{
+	task_future<drain_result> drained;
+	task_future<void> stopped;
+};
+
+// Compile-time configuration of basic_thread_pool. A policy derives from this
+// one and overrides what it changes. A feature switched off here is compiled
+// out of the task path rather than tested per task, and the matching runtime
+// setting is ignored.
+struct default_pool_policy
+{
+	// Backend of the shared queue; it must satisfy pool_queue. Priorities past
+	// its last level share that level, so priority_levels<1> is a plain FIFO.
+	using queue_backend = priority_levels<task_priority_count>;
+	// Allocator of the queue storage and the stealing nodes.
+	template <typename value_type_t>
+	using allocator = slab_allocator<value_type_t>;
+	// What set_idle_policy() starts from.
+	static constexpr idle_policy idle = {};
+	// The debug_mode printouts and end-of-run report.
+	static constexpr bool debug_output = true;
+	// Per-task clock reads and the per-worker counters behind stats(). Off,
+	// stats() only has the queue-level counts, and the elastic policy's
+	// wait_threshold never triggers.
+	static constexpr bool metrics = true;
+	// set_trace_file().
+	static constexpr bool tracing = true;
+	// The status table behind get_status(), which keeps each task's state and
+	// size_t result. Off, get_status() knows no task.
+	static constexpr bool task_status = true;
+	// How deep waits may nest on a worker, each running other tasks on top of
+	// the stack of the one before. A wait past this blocks while some other
+	// worker can still run tasks; once none can, the capped waits run tasks
+	// anyway rather than stop the pool.
+	static constexpr size_t wait_depth = 128;
+};
+
+// Nothing but scheduling: no printouts, counters, trace or status table.
+// Futures, error handlers and backpressure still work.
+struct production_pool_policy : default_pool_policy
+{
+	static constexpr bool debug_output = false;
+	static constexpr bool metrics = false;
+	static constexpr bool tracing = false;
+	static constexpr bool task_status = false;
+};
+
+template <typename policy_t = default_pool_policy>
+class basic_thread_pool
 {
 public:
-	inline thread_pool() = default;
-	inline ~thread_pool() { terminate(); }
+	using task_type = move_only_task<size_t()>;
+	using unstarted_task = ::unstarted_task;
+	using drain_result = ::drain_result;
+	// co_await pool.schedule() continues the coroutine on one of the workers.
+	// If the pool discards the queued continuation instead, the coroutine
+	// continues wherever that happens and co_await throws task_dropped
+	// (drop_oldest) or std::future_error (a terminate_now() task destroyed).
+	struct schedule_awaiter {
+		basic_thread_pool& pool;
+		task_priority priority;
+		std::exception_ptr error;
+		inline bool await_ready() const noexcept { return false; }
+		inline bool await_suspend(std::coroutine_handle<> handle);
+		inline void await_resume() const { if (error) { std::rethrow_exception(error); } }
+	};
+	// co_await pool.sleep_for(d) suspends until d has passed without holding a
+	// worker, then continues on one. Discarded, it throws as schedule() does.
+	struct timer_awaiter {
+		basic_thread_pool& pool;
+		std::chrono::steady_clock::time_point due;
+		task_priority priority;
+		std::exception_ptr error;
+		inline bool await_ready() const { return due <= std::chrono::steady_clock::now(); }
+		inline bool await_suspend(std::coroutine_handle<> handle);
+		inline void await_resume() const { if (error) { std::rethrow_exception(error); } }
+	};
+	// Returned by add_periodic(). cancel() stops further runs; one already
+	// queued or running still finishes.
+	class periodic_handle {
+	public:
+		inline periodic_handle() = default;
+		inline explicit periodic_handle(std::shared_ptr<std::atomic<bool>> cancelled) : m_cancelled(std::move(cancelled)) {}
+		inline bool valid() const { return m_cancelled != nullptr; }
+		inline void cancel() { if (m_cancelled) { m_cancelled->store(true); } }
+	private:
+		std::shared_ptr<std::atomic<bool>> m_cancelled;
+	};
+public:
+	inline basic_thread_pool() = default;
+	inline ~basic_thread_pool();
 public:
-	void initialize(const size_t worker_count, bool debug_mode);
+	void initialize(const size_t worker_count, bool debug_mode = false, scheduler_mode mode = scheduler_mode::global_queue);
+	void initialize(const pool_config& config);
 	void terminate();
-	void terminate_now();
+	std::vector<unstarted_task> terminate_now();
+	drain_result drain(const std::chrono::milliseconds timeout);
+	shutdown_handle shutdown_async(const std::chrono::milliseconds timeout);
 	void debug_terminate();
-	void routine();
+	void routine(const size_t index);
+	void stealing_routine(const size_t index);
 	bool working() const;
 	bool working_unsafe() const;
+	inline bool in_worker_thread() const { return s_current_pool == this; }
+	inline size_t worker_count() const { return m_active_workers.load(); }
 public:
 	template <typename task_t, typename... arguments>
 	inline size_t add_task(task_t&& task, arguments&&... parameters);
+	template <typename task_t, typename... arguments>
+	inline size_t add_task(task_priority priority, task_t&& task, arguments&&... parameters);
+	template <typename task_t, typename... arguments>
+	inline submit_result try_add_task(task_t&& task, arguments&&... parameters);
+	template <typename task_t, typename... arguments>
+	inline submit_result try_add_task(task_priority priority, task_t&& task, arguments&&... parameters);
+	template <typename task_t, typename... arguments>
+	inline auto submit(task_t&& task, arguments&&... parameters);
+	template <typename task_t, typename... arguments>
+	inline auto submit(task_priority priority, task_t&& task, arguments&&... parameters);
+	template <typename iterator_t>
+	inline size_t add_tasks(iterator_t first, iterator_t last);
+	template <typename rep, typename period, typename task_t, typename... arguments>
+	inline size_t add_task_after(const std::chrono::duration<rep, period>& delay, task_t&& task, arguments&&... parameters);
+	template <typename task_t, typename... arguments>
+	inline size_t add_task_at(const std::chrono::steady_clock::time_point due, task_t&& task, arguments&&... parameters);
+	template <typename task_t, typename... arguments>
+	inline size_t add_task_at(const std::chrono::steady_clock::time_point due, task_priority priority, task_t&& task, arguments&&... parameters);
+	template <typename rep, typename period, typename task_t, typename... arguments>
+	inline periodic_handle add_periodic(const std::chrono::duration<rep, period>& interval, task_t&& task, arguments&&... parameters);
+	template <typename task_t>
+	inline size_t add_tasks(std::span<task_t> tasks) { return add_tasks(tasks.begin(), tasks.end()); }
+	template <typename result_t>
+	inline void wait(const task_future<result_t>& future);
+	template <typename predicate_t>
+	inline void wait_until(predicate_t&& done);
+	template <std::integral index_t, typename function_t>
+	inline void parallel_for(const index_t first, const index_t last, function_t&& function, const size_t grain = 0);
+	template <std::integral index_t, typename value_t, typename transform_t, typename combine_t>
+	inline value_t parallel_reduce(const index_t first, const index_t last, value_t identity, transform_t&& transform, combine_t&& combine, const size_t grain = 0);
 	size_t get_status(size_t id);
+	void set_status_retention(const size_t task_count);
+	void set_batch_dequeue(const size_t max_batch);
+	void set_idle_policy(const idle_policy& policy);
+	void set_elastic_policy(const elastic_policy& policy);
+	void set_backpressure(const backpressure_policy& policy);
+	void set_error_handler(std::function<void(size_t, std::exception_ptr)> handler);
+	void set_priority_aging(const size_t step);
+	void set_metrics_export(const std::chrono::milliseconds interval, std::function<void(const pool_stats&)> sink);
+	pool_stats stats() const;
+	void set_trace_file(const std::string& path);
+	inline schedule_awaiter schedule(task_priority priority = task_priority::normal) { return schedule_awaiter{ *this, priority, nullptr }; }
+	inline timer_awaiter sleep_until(const std::chrono::steady_clock::time_point due, task_priority priority = task_priority::normal) { return timer_awaiter{ *this, due, priority, nullptr }; }
+	template <typename rep, typename period>
+	inline timer_awaiter sleep_for(const std::chrono::duration<rep, period>& delay, task_priority priority = task_priority::normal);
 public:
-	thread_pool(const thread_pool& other) = delete;
-	thread_pool(thread_pool&& other) = delete;
-	thread_pool& operator=(const thread_pool& rhs) = delete;
-	thread_pool& operator=(thread_pool&& rhs) = delete;
+	basic_thread_pool(const basic_thread_pool& other) = delete;
+	basic_thread_pool(basic_thread_pool&& other) = delete;
+	basic_thread_pool& operator=(const basic_thread_pool& rhs) = delete;
+	basic_thread_pool& operator=(basic_thread_pool&& rhs) = delete;
 private:
 	struct TaskStatus {
 		enum Status {
 			Waiting,
 			Working,
-			Finished
-		} status;
-		size_t result = NULL;
+			Finished,
+			Failed
+		} status = Waiting;
+		size_t result = 0;
 	};
-	mutable read_write_lock m_rw_lock;
-	mutable read_write_lock m_print_lock;
-	mutable std::condition_variable_any m_task_waiter;
-	std::vector<std::thread> m_workers;
-	task_queue<std::function<size_t()>> m_tasks;
-	std::unordered_map<size_t, TaskStatus> m_task_status;
-	std::unordered_map<size_t, std::chrono::time_point<std::chrono::system_clock>> m_debug_queue_time;
-	double m_wait_time = 0.0;
-	int m_avg_queue_len = 0;
-	int m_avg_read_cnt = 0;
-	size_t m_tasks_processed = 0;
+	// What the queues hold: the callable plus what was known at enqueue time.
+	// queued_at is only set when metrics or tracing are on.
+	struct queued_task {
+		task_type task;
+		std::chrono::steady_clock::time_point queued_at;
+		task_priority priority = task_priority::normal;
+	};
+	// Allocator behind the task queues and stealing nodes: the node a producer
+	// allocates is freed by whichever worker runs it.
+	template <typename value_type_t>
+	using pool_allocator = typename policy_t::template allocator<value_type_t>;
+	// The task an awaiter queues. Destroyed unrun, it still resumes the
+	// coroutine, with error set, so the frame is neither leaked nor left
+	// waiting forever.
+	struct coroutine_resume {
+		std::coroutine_handle<> handle;
+		std::exception_ptr* error;
+		inline coroutine_resume(std::coroutine_handle<> suspended, std::exception_ptr* result) : handle(suspended), error(result) {}
+		inline coroutine_resume(coroutine_resume&& other) noexcept : handle(std::exchange(other.handle, nullptr)), error(other.error) {}
+		inline ~coroutine_resume();
+		inline size_t operator()() { std::exchange(handle, nullptr).resume(); return 0; }
+		coroutine_resume& operator=(coroutine_resume&& rhs) = delete;
+	};
+	struct stealing_task {
+		size_t id;
+		queued_task task;
+		static inline void* operator new(const size_t) { return pool_allocator<stealing_task>().allocate(1); }
+		static inline void operator delete(void* pointer) noexcept { pool_allocator<stealing_task>().deallocate(static_cast<stealing_task*>(pointer), 1); }
+	};
+	// Thieves only touch the deque; the rest is the owner's.
+	struct alignas(cache_line_size) worker_state {
+		work_stealing_deque<stealing_task*> deque;
+		alignas(cache_line_size) std::minstd_rand random;
+		size_t domain = 0;
+		std::vector<size_t> near_victims;
+		std::vector<size_t> far_victims;
+		std::vector<queued_task> batch;
+		std::vector<size_t> batch_ids;
+	};
+	struct alignas(cache_line_size) scheduler_domain {
+		task_queue<stealing_task*, unbounded_locked, pool_allocator<stealing_task*>> tasks;
+	};
+	// Workers dequeue straight from the queue without the pool lock, which only
+	// guards configuration and the running/stopped state.
+	using shared_queue = task_queue<queued_task, typename policy_t::queue_backend, pool_allocator<queued_task>>;
+	static_assert(pool_queue<shared_queue, queued_task>, "shared_queue does not provide what the pool's workers use");
+	struct periodic_job {
+		task_type task;
+		std::chrono::steady_clock::duration interval;
+		std::shared_ptr<std::atomic<bool>> cancelled;
+		// Set while a run is queued or in progress, so runs never overlap.
+		std::atomic<bool> running = false;
+	};
+	// What the timer wheel holds: a one-shot task with its reserved id, or a
+	// periodic job that is queued again every interval.
+	struct timer_entry {
+		size_t id = 0;
+		queued_task task;
+		std::shared_ptr<periodic_job> periodic;
+		std::chrono::steady_clock::time_point due;
+	};
+	void place_workers(const pool_config& config);
+	void pin_worker(const size_t index);
+	size_t caller_domain();
+	void run_task(const size_t index, const size_t task_id, queued_task& task, const size_t queue_len);
+	void task_failed(const size_t index, const size_t task_id, std::exception_ptr error);
+	size_t run_on_caller(const size_t task_id, task_type& task);
+	bool acquire_task(const size_t index, queued_task& task, size_t& task_id);
+	bool take_shared_task(const size_t index, queued_task& task, size_t& task_id, size_t& queue_len);
+	bool steal_task(worker_state& self, const std::vector<size_t>& victims, stealing_task*& acquired);
+	bool work_available() const;
+	void idle_wait();
+	void wake_workers(const size_t count);
+	void wake_all_workers();
+	void wake_waiters();
+	template <typename predicate_t, typename help_t>
+	void wait_helping(predicate_t& done, help_t&& help);
+	template <typename predicate_t>
+	void park_waiter(predicate_t& done);
+	void discard_queued_tasks();
+	bool run_pending_task();
+	std::vector<unstarted_task> take_queued();
+	void finish_termination();
+	void worker_exited(const size_t index);
+	enum class admission
+	{
+		queued,
+		full,
+		run_here,
+		stopped
+	};
+	admission admit(const size_t count, read_lock& lock, size_t* fitted = nullptr);
+	size_t admission_capacity() const;
+	bool try_reserve(const size_t count, size_t& pending);
+	size_t reserve_part(const size_t count, size_t& pending);
+	void raise_pending(const size_t count);
+	size_t release_pending(const size_t count);
+	void crossed_high(const size_t pending);
+	void notify_watermarks();
+	bool drop_queued_task(queued_task& evicted);
+	void wake_blocked_producers();
+	bool schedule_timer(timer_entry&& entry);
+	void timer_routine();
+	bool enqueue_due(std::vector<typename shared_queue::reserved_task>& due);
+	void take_timers(std::vector<unstarted_task>& taken);
+	void close_timers();
+	void start_worker(const size_t index);
+	bool retire_requested(const size_t index);
+	void scale_routine();
+	void stop_scaling();
+	// parallel_for / parallel_reduce state. Split-off pieces of the range wait
+	// in pieces until a helper task or the calling thread takes them.
+	struct range_piece {
+		size_t first = 0;
+		size_t last = 0;
+	};
+	struct range_split {
+		task_queue<range_piece, unbounded_locked, pool_allocator<range_piece>> pieces;
+		std::atomic<size_t> queued = 0;
+		std::atomic<size_t> outstanding = 0;
+		size_t grain = 1;
+	};
+	template <typename index_t, typename function_t>
+	struct for_range : range_split {
+		index_t first;
+		function_t& function;
+		inline for_range(const index_t begin, function_t& body) : first(begin), function(body) {}
+		inline int start(const size_t) { return 0; }
+		inline void run(int&, const size_t from, const size_t to) { for (size_t index = from; index < to; index++) { function(static_cast<index_t>(first + index)); } }
+		inline void finish(int&, const size_t) {}
+	};
+	template <typename index_t, typename value_t, typename transform_t, typename combine_t>
+	struct reduce_range : range_split {
+		struct partial {
+			size_t first;
+			value_t value;
+			partial* next;
+		};
+		index_t first;
+		const value_t& identity;
+		transform_t& transform;
+		combine_t& combine;
+		std::atomic<partial*> partials = nullptr;
+		inline reduce_range(const index_t begin, const value_t& zero, transform_t& map, combine_t& reduce) : first(begin), identity(zero), transform(map), combine(reduce) {}
+		inline ~reduce_range();
+		inline value_t start(const size_t) { return identity; }
+		inline void run(value_t& value, const size_t from, const size_t to) { for (size_t index = from; index < to; index++) { value = combine(std::move(value), transform(static_cast<index_t>(first + index))); } }
+		inline void finish(value_t& value, const size_t piece_first);
+		inline value_t collect();
+	};
+	size_t default_grain(const size_t count) const;
+	template <typename job_t>
+	inline void run_job(const std::shared_ptr<job_t>& job, const size_t count, const size_t grain);
+	template <typename job_t>
+	inline void run_range(const std::shared_ptr<job_t>& job, const range_piece piece);
+	template <typename job_t>
+	inline bool take_range(const std::shared_ptr<job_t>& job);
+	// The policy's compile-time switches combined with the runtime settings;
+	// constant false for a switch the policy turns off.
+	inline bool debug_enabled() const { if constexpr (policy_t::debug_output) { return m_debug; } else { return false; } }
+	inline bool collecting_metrics() const { if constexpr (policy_t::metrics) { return m_collect_metrics; } else { return false; } }
+	inline bool tracing() const { if constexpr (policy_t::tracing) { return m_trace != nullptr; } else { return false; } }
+	template <typename updater_t>
+	inline void update_status(const size_t id, updater_t&& updater) { if constexpr (policy_t::task_status) { m_task_status.update(id, std::forward<updater_t>(updater)); } }
+	inline void erase_status(const size_t id) { if constexpr (policy_t::task_status) { m_task_status.erase(id); } }
+	pool_stats collect_stats() const;
+	void export_routine();
+	void stop_export();
+	// Grouped by who writes what. First what initialize() and terminate() set
+	// and every task reads, then one cache line for each lock or counter that
+	// producers and workers write per task, so none of those invalidates the
+	// read-mostly block or each other, then everything off the task path.
+	size_t m_max_batch = 1;
+	bool m_collect_metrics = true;
 	bool m_initialized = false;
-	bool m_terminated = false;
 	bool m_debug = false;
+	std::atomic<bool> m_terminated = false;
+	scheduler_mode m_mode = scheduler_mode::global_queue;
+	idle_policy m_idle = policy_t::idle;
+	std::unique_ptr<trace_logger> m_trace;
+	// One slot per possible worker; slots above the running count hold finished
+	// or never-started threads.
+	std::unique_ptr<std::atomic<bool>[]> m_worker_running;
+	std::atomic<size_t> m_active_workers = 0;
+	std::atomic<size_t> m_retire_requests = 0;
+	std::vector<std::unique_ptr<worker_state>> m_worker_states;
+	std::vector<std::unique_ptr<scheduler_domain>> m_domains;
+	// One block per worker, written only by that worker; kept after terminate
+	// so the last run can still be read.
+	std::vector<std::unique_ptr<worker_metrics>> m_worker_metrics;
+	backpressure_policy m_backpressure;
+	std::function<void(size_t, std::exception_ptr)> m_error_handler;
+	std::atomic<bool> m_above_high = false;
+	// Crossings seen under the pool lock, for notify_watermarks() to report
+	// once it is released.
+	std::atomic<uint32_t> m_watermark_events = 0;
+	std::atomic<size_t> m_high_depth = 0;
+	std::atomic<size_t> m_low_depth = 0;
+	std::atomic<size_t> m_blocked_producers = 0;
+	// Taken shared by every submit.
+	alignas(cache_line_size) mutable read_write_lock m_rw_lock;
+	// Tasks enqueued but not yet taken by a worker, in any queue.
+	alignas(cache_line_size) std::atomic<size_t> m_pending_tasks = 0;
+	alignas(cache_line_size) std::atomic<size_t> m_sleeping_workers = 0;
+	std::atomic<uint32_t> m_wake_epoch = 0;
+	// Threads parked in a wait; see park_waiter().
+	std::atomic<size_t> m_waiting_threads = 0;
+	// Workers in a wait past policy_t::wait_depth; see wait_helping().
+	std::atomic<size_t> m_capped_workers = 0;
+	uint64_t m_waiter_epoch = 0;
+	std::mutex m_waiter_mutex;
+	std::condition_variable m_waiter_signal;
+	alignas(cache_line_size) std::atomic<size_t> m_next_domain = 0;
+	std::atomic<uint64_t> m_tasks_rejected = 0;
+	std::atomic<uint64_t> m_tasks_dropped = 0;
+	alignas(cache_line_size) shared_queue m_tasks;
+	alignas(cache_line_size) std::conditional_t<policy_t::task_status, status_table<TaskStatus>, std::monostate> m_task_status;
+	alignas(cache_line_size) mutable read_write_lock m_print_lock;
+	std::vector<std::thread> m_workers;
+	size_t m_worker_floor = 0;
+	elastic_policy m_elastic;
+	std::thread m_scaler;
+	std::mutex m_scale_mutex;
+	std::condition_variable m_scale_signal;
+	bool m_scale_stop = false;
+	// Serializes terminate(), terminate_now() and drain() with each other.
+	std::mutex m_shutdown_lock;
+	std::mutex m_exit_mutex;
+	std::condition_variable m_exit_signal;
+	std::thread m_shutdown_thread;
+	// Delayed and periodic tasks, serviced by a thread started on first use.
+	// Closed while the pool is not running.
+	timer_wheel<timer_entry> m_timers;
+	std::thread m_timer_thread;
+	std::mutex m_timer_mutex;
+	std::condition_variable m_timer_signal;
+	bool m_timers_closed = true;
+	std::vector<std::vector<size_t>> m_worker_cpus;
+	std::vector<size_t> m_worker_domain;
+	std::vector<size_t> m_cpu_domain;
+	std::mutex m_space_mutex;
+	std::condition_variable m_space_signal;
+	inline static thread_local basic_thread_pool* s_current_pool = nullptr;
+	inline static thread_local size_t s_worker_index = 0;
+	inline static thread_local size_t s_wait_depth = 0;
+	inline static thread_local bool s_capped = false;
+	std::thread m_exporter;
+	std::mutex m_export_mutex;
+	std::condition_variable m_export_signal;
+	std::chrono::milliseconds m_export_interval{ 0 };
+	std::function<void(const pool_stats&)> m_export_sink;
+	bool m_export_stop = false;
+	std::string m_trace_path;
 };
 
-bool thread_pool::working() const
+using thread_pool = basic_thread_pool<default_pool_policy>;
+
+// A pending shutdown_async() finishes before the pool goes away.
+template <typename policy_t>
+basic_thread_pool<policy_t>::~basic_thread_pool()
+{
+	terminate();
+	if (m_shutdown_thread.joinable())
+	{
+		m_shutdown_thread.join();
+	}
+}
+
+template <typename policy_t>
+bool basic_thread_pool<policy_t>::working() const
 {
 	read_lock _(m_rw_lock);
 	return working_unsafe();
 }
-bool thread_pool::working_unsafe() const
+template <typename policy_t>
+bool basic_thread_pool<policy_t>::working_unsafe() const
 {
 	return m_initialized && !m_terminated;
 }
 
-void thread_pool::initialize(const size_t worker_count, bool debug_mode = false)
+template <typename policy_t>
+void basic_thread_pool<policy_t>::initialize(const size_t worker_count, bool debug_mode, scheduler_mode mode)
+{
+	pool_config config;
+	config.worker_count = worker_count;
+	config.debug_mode = debug_mode;
+	config.mode = mode;
+	initialize(config);
+}
+
+template <typename policy_t>
+void basic_thread_pool<policy_t>::initialize(const pool_config& config)
 {
 	write_lock _(m_rw_lock);
 	if (m_initialized || m_terminated)
 	{
 		return;
 	}
-	m_debug = debug_mode;
-	if (m_debug == true) {
+	size_t worker_count = config.worker_count;
+	size_t slot_count = m_elastic.max_workers == 0 ? worker_count : std::max(worker_count, m_elastic.max_workers);
+	m_worker_floor = m_elastic.max_workers == 0 ? worker_count : std::clamp<size_t>(m_elastic.min_workers, 1, std::max<size_t>(worker_count, 1));
+	m_debug = config.debug_mode;
+	m_mode = config.mode;
+	m_collect_metrics = config.collect_metrics || debug_enabled();
+	if (debug_enabled()) {
 		m_print_lock.lock();
 		printf("STR: Initializing %zu workers.\n", worker_count);
 		m_print_lock.unlock();
 	}
-	m_workers.reserve(worker_count);
-	for (size_t id = 0; id < worker_count; id++)
+	pool_config slots = config;
+	slots.worker_count = slot_count;
+	place_workers(slots);
+	m_worker_metrics.clear();
+	m_trace.reset();
+	if (policy_t::tracing && !m_trace_path.empty())
 	{
-		m_workers.emplace_back(&thread_pool::routine, this);
+		m_trace.reset(new trace_logger(m_trace_path));
+		if (!m_trace->is_open())
+		{
+			if (debug_enabled()) {
+				m_print_lock.lock();
+				printf("STR: Could not open trace file %s.\n", m_trace_path.c_str());
+				m_print_lock.unlock();
+			}
+			m_trace.reset();
+		}
 	}
-	m_initialized = !m_workers.empty();
-}
-
-void thread_pool::routine()
-{
-	while (true)
+	for (size_t id = 0; id < slot_count; id++)
 	{
-		bool task_acquired = false;
-		size_t task_id = -1;
-		size_t queue_len = 0;
-		std::function<size_t()> task;
+		m_worker_metrics.emplace_back(new worker_metrics(task_priority_count));
+	}
+	// global_queue workers use their deque too, for the rest of a batch.
+	{
+		std::random_device seed;
+		m_worker_states.reserve(slot_count);
+		for (size_t id = 0; id < slot_count; id++)
 		{
-			write_lock _(m_rw_lock);
-			auto wait_condition = [this, &task_acquired, &task_id, &task, &queue_len] {
-				task_acquired = m_tasks.pop(task, task_id);
-				queue_len = m_tasks.size();
-				return m_terminated || task_acquired;
-				};
-			m_task_waiter.wait(_, wait_condition);
+			m_worker_states.emplace_back(new worker_state);
+			m_worker_states.back()->random.seed(seed());
+			m_worker_states.back()->domain = m_worker_domain[id];
 		}
-		if (m_terminated && !task_acquired)
+		for (size_t id = 0; id < slot_count; id++)
 		{
-			return;
-		}
-		m_task_status[task_id].status = thread_pool::TaskStatus::Status::Working;
-		if (m_debug == true) {
-			m_print_lock.lock();
-			auto time_now = std::chrono::system_clock::now();
-			auto elapsed = duration_cast<nanoseconds>(time_now - m_debug_queue_time[task_id]);
-			m_wait_time += elapsed.count() * 1e-6;
-			m_avg_read_cnt++;
-			m_avg_queue_len += queue_len;
-			printf("WRK: Task ID %2zu began working. Queue wait time %.3f miliseconds.\n", task_id, elapsed.count() * 1e-6);
-			m_print_lock.unlock();
-		}
-		m_task_status[task_id].result = task();
-		m_task_status[task_id].status = thread_pool::TaskStatus::Status::Finished;
-		if (m_debug == true) {
-			m_print_lock.lock();
-			m_tasks_processed++;
-			printf("END: Task ID %2zu returned %zu.\n", task_id, m_task_status[task_id].result);
-			m_print_lock.unlock();
+			worker_state& state = *m_worker_states[id];
+			for (size_t victim = 0; victim < slot_count; victim++)
+			{
+				if (victim != id)
+				{
+					(m_worker_domain[victim] == state.domain ? state.near_victims : state.far_victims).push_back(victim);
+				}
+			}
 		}
 	}
-}
-template <typename task_t, typename... arguments>
-size_t thread_pool::add_task(task_t&& task, arguments&&... parameters)
-{
+	m_workers.clear();
+	m_workers.resize(slot_count);
+	m_worker_running.reset(new std::atomic<bool>[slot_count]);
+	for (size_t id = 0; id < slot_count; id++)
 	{
-		read_lock _(m_rw_lock);
-		if (!working_unsafe()) {
-			return -1;
-		}
+		m_worker_running[id] = false;
 	}
-	auto bind = std::bind(std::forward<task_t>(task),
-		std::forward<arguments>(parameters)...);
-	size_t id = m_tasks.emplace(bind);
-	m_task_status[id].status = thread_pool::TaskStatus::Status::Waiting;
-	m_avg_read_cnt++;
-	m_avg_queue_len += m_tasks.size();
-	m_task_waiter.notify_one();
-	if (m_debug == true) {
-		m_print_lock.lock();
-		printf("ADD: Task ID %2zu was added to the queue.\n", id);
-		m_debug_queue_time[id] = std::chrono::system_clock::now();
-		m_print_lock.unlock();
+	m_retire_requests = 0;
+	for (size_t id = 0; id < worker_count; id++)
+	{
+		start_worker(id);
+	}
+	{
+		std::lock_guard<std::mutex> lock(m_timer_mutex);
+		m_timers_closed = worker_count == 0;
+	}
+	m_initialized = worker_count > 0;
+	if (m_initialized && m_export_sink && m_export_interval.count() > 0)
+	{
+		m_export_stop = false;
+		m_exporter = std::thread(&basic_thread_pool::export_routine, this);
+	}
+	if (m_initialized && slot_count > m_worker_floor)
+	{
+		m_scale_stop = false;
+		m_scaler = std::thread(&basic_thread_pool::scale_routine, this);
 	}
-	return id;
 }
 
-
-size_t thread_pool::get_status(size_t id)
+// Caller holds the pool lock exclusively, so the slot is not read while it
+// changes.
+template <typename policy_t>
+void basic_thread_pool<policy_t>::start_worker(const size_t index)
 {
-	if (m_task_status.count(id) == 0) {
-		std::cout << "No such task exists." << std::endl;
-		return 0;
+	if (m_workers[index].joinable())
+	{
+		m_workers[index].join();
 	}
-	auto task_status = m_task_status.at(id);
-	if (task_status.status == thread_pool::TaskStatus::Status::Waiting) {
-		std::cout << "Task " << id << " is in the task queue." << std::endl;
+	m_worker_running[index] = true;
+	m_active_workers.fetch_add(1);
+	if (m_mode == scheduler_mode::work_stealing)
+	{
+		m_workers[index] = std::thread(&basic_thread_pool::stealing_routine, this, index);
 	}
-	else if (task_status.status == thread_pool::TaskStatus::Status::Working) {
-		std::cout << "Task " << id << " is being processed." << std::endl;
-		return 0;
+	else
+	{
+		m_workers[index] = std::thread(&basic_thread_pool::routine, this, index);
 	}
-	return task_status.result;
-
 }
 
-void thread_pool::terminate()
+// Every worker leaves through here, retired or not. Last one out wakes a
+// drain() waiting for the workers.
+template <typename policy_t>
+void basic_thread_pool<policy_t>::worker_exited(const size_t index)
 {
-	if (m_debug == true) {
-		m_print_lock.lock();
-		printf("TRM: Terminate called.\n");
-		m_print_lock.unlock();
+	m_worker_running[index] = false;
+	if (m_active_workers.fetch_sub(1) == 1)
+	{
+		std::lock_guard<std::mutex> lock(m_exit_mutex);
+		m_exit_signal.notify_all();
 	}
+}
+
+// A parked worker that finds a retire request takes it and exits. It must
+// not leave tasks behind on its deque.
+template <typename policy_t>
+bool basic_thread_pool<policy_t>::retire_requested(const size_t index)
+{
+	size_t requests = m_retire_requests.load();
+	while (requests > 0)
 	{
-		write_lock _(m_rw_lock);
-		if (working_unsafe())
+		if (!m_worker_states[index]->deque.empty())
+		{
+			return false;
+		}
+		if (m_retire_requests.compare_exchange_weak(requests, requests - 1))
 		{
-			if (m_debug == true) {
+			if (debug_enabled()) {
 				m_print_lock.lock();
-				printf("TRM: Waiting for tasks to finish.\n");
+				printf("STR: Worker %zu retired, %zu left.\n", index, m_active_workers.load() - 1);
 				m_print_lock.unlock();
 			}
-			m_terminated = true;
+			worker_exited(index);
+			return true;
 		}
-		else
+	}
+	return false;
+}
+
+// The load signal is the queue length the pool already tracks plus, with
+// metrics on, the mean queue wait of the tasks started since the last check.
+template <typename policy_t>
+void basic_thread_pool<policy_t>::scale_routine()
+{
+	uint64_t last_wait_count = 0;
+	uint64_t last_wait_sum = 0;
+	auto idle_since = std::chrono::steady_clock::now();
+	std::unique_lock<std::mutex> lock(m_scale_mutex);
+	while (!m_scale_signal.wait_for(lock, m_elastic.check_interval, [this] { return m_scale_stop; }))
+	{
+		lock.unlock();
+		uint64_t wait_count = 0;
+		uint64_t wait_sum = 0;
+		for (const std::unique_ptr<worker_metrics>& metrics : m_worker_metrics)
 		{
-			if (m_debug == true) {
-				debug_terminate();
+			wait_count += metrics->queue_wait.count();
+			wait_sum += metrics->queue_wait.sum();
+		}
+		double mean_wait = wait_count > last_wait_count ? double(wait_sum - last_wait_sum) / double(wait_count - last_wait_count) : 0.0;
+		last_wait_count = wait_count;
+		last_wait_sum = wait_sum;
+		size_t active = m_active_workers.load();
+		size_t pending = m_pending_tasks.load();
+		bool backlog = pending > m_elastic.queue_depth * active
+			|| mean_wait > double(duration_cast<nanoseconds>(m_elastic.wait_threshold).count());
+		auto now = std::chrono::steady_clock::now();
+		size_t requests = m_retire_requests.load();
+		if (backlog)
+		{
+			// Withdraw a retire request no worker has taken yet; workers
+			// take them with the same compare-exchange, so each goes once.
+			while (requests > 0 && !m_retire_requests.compare_exchange_weak(requests, requests - 1)) {}
+		}
+		if (backlog && m_sleeping_workers.load() == 0)
+		{
+			write_lock _(m_rw_lock);
+			size_t index = 0;
+			while (index < m_workers.size() && m_worker_running[index])
+			{
+				index++;
 			}
-			m_workers.clear();
-			m_terminated = false;
-			m_initialized = false;
-			return;
+			if (working_unsafe() && index < m_workers.size())
+			{
+				start_worker(index);
+				if (debug_enabled()) {
+					m_print_lock.lock();
+					printf("STR: Started worker %zu, %zu running.\n", index, active + 1);
+					m_print_lock.unlock();
+				}
+			}
+			idle_since = now;
+		}
+		else if (pending != 0 || m_sleeping_workers.load() == 0)
+		{
+			idle_since = now;
+		}
+		else if (now - idle_since >= m_elastic.idle_timeout && requests == 0 && active > m_worker_floor)
+		{
+			// One request needs one worker; the others stay parked. Any
+			// worker that is awake sees the request in work_available(),
+			// and it stands until one takes it or a backlog withdraws it.
+			m_retire_requests.fetch_add(1);
+			wake_workers(1);
+			idle_since = now;
 		}
+		lock.lock();
 	}
-	m_task_waiter.notify_all();
-	for (std::thread& worker : m_workers)
+}
+
+// Must run before the worker threads are joined, since the scaler may still
+// be starting some.
+template <typename policy_t>
+void basic_thread_pool<policy_t>::stop_scaling()
+{
+	if (!m_scaler.joinable())
 	{
-		worker.join();
+		return;
 	}
-	if (m_debug == true) {
-		debug_terminate();
+	{
+		std::lock_guard<std::mutex> lock(m_scale_mutex);
+		m_scale_stop = true;
 	}
-	m_workers.clear();
-	m_terminated = false;
-	m_initialized = false;
+	m_scale_signal.notify_one();
+	m_scaler.join();
 }
 
-inline void thread_pool::terminate_now()
+// Counts count new tasks as pending if the backpressure policy lets them in.
+// An empty queue always takes a batch, even one larger than the capacity.
+// lock is the caller's shared hold on the pool lock. It is released while a
+// blocked producer waits, so terminate() can get in, and not taken back for
+// run_here, since the task then runs on the caller and may submit or stop
+// the pool itself. A caller that passes fitted lets caller_runs admit just
+// the first *fitted tasks, as many as there is room for, keeping the lock;
+// the caller runs the rest itself.
+template <typename policy_t>
+typename basic_thread_pool<policy_t>::admission basic_thread_pool<policy_t>::admit(const size_t count, read_lock& lock, size_t* fitted)
 {
-	if (m_debug == true) {
-		m_print_lock.lock();
-		printf("TRM: Urgent termination called.\n");
-		printf("TRM: Clearing the task queue.\n");
-		m_print_lock.unlock();
+	if (admission_capacity() == 0)
+	{
+		raise_pending(count);
+		return admission::queued;
 	}
+	size_t pending = 0;
+	if (fitted != nullptr && m_backpressure.overflow == overflow_policy::caller_runs)
 	{
-		write_lock _(m_rw_lock);
-		m_tasks.clear();
-		if (working_unsafe())
+		if ((*fitted = reserve_part(count, pending)) == 0)
 		{
-			if (m_debug == true) {
-				m_print_lock.lock();
-				printf("TRM: Waiting for tasks to finish.\n");
-				m_print_lock.unlock();
+			lock.unlock();
+			return admission::run_here;
+		}
+		crossed_high(pending);
+		return admission::queued;
+	}
+	if (shared_queue::bound != 0 && count > shared_queue::bound)
+	{
+		// A batch the shared queue can never hold, not even empty.
+		if (m_backpressure.overflow == overflow_policy::caller_runs || m_backpressure.overflow == overflow_policy::block)
+		{
+			lock.unlock();
+			return admission::run_here;
+		}
+		m_tasks_rejected.fetch_add(count, std::memory_order_relaxed);
+		return admission::full;
+	}
+	while (!try_reserve(count, pending))
+	{
+		switch (m_backpressure.overflow)
+		{
+		case overflow_policy::reject:
+			m_tasks_rejected.fetch_add(count, std::memory_order_relaxed);
+			return admission::full;
+		case overflow_policy::caller_runs:
+			lock.unlock();
+			return admission::run_here;
+		case overflow_policy::drop_oldest:
+		{
+			// Frees a slot for the next attempt, which another producer may
+			// still win. The evicted task is destroyed without the lock,
+			// since that fails its future or resumes its coroutine.
+			queued_task evicted;
+			if (drop_queued_task(evicted))
+			{
+				lock.unlock();
+				{
+					abandon_reason reason(std::make_exception_ptr(task_dropped()));
+					evicted = queued_task();
+				}
+				lock.lock();
+				if (!working_unsafe())
+				{
+					return admission::stopped;
+				}
 			}
-			m_terminated = true;
+			break;
 		}
-		else
+		case overflow_policy::block:
+			if (in_worker_thread())
+			{
+				lock.unlock();
+				return admission::run_here;
+			}
+			lock.unlock();
+			bool reserved = false;
+			{
+				std::unique_lock<std::mutex> space(m_space_mutex);
+				m_blocked_producers.fetch_add(1);
+				m_space_signal.wait(space, [&] { return m_terminated.load() || (reserved = try_reserve(count, pending)); });
+				m_blocked_producers.fetch_sub(1);
+			}
+			lock.lock();
+			if (!working_unsafe())
+			{
+				if (reserved)
+				{
+					release_pending(count);
+				}
+				return admission::stopped;
+			}
+			if (!reserved)
+			{
+				// Woken by a terminate() that has already finished and a new
+				// initialize(): wait for room again in the new run.
+				return admit(count, lock);
+			}
+			crossed_high(pending);
+			return admission::queued;
+		}
+	}
+	crossed_high(pending);
+	return admission::queued;
+}
+
+// The policy's capacity, capped by a bounded shared queue so that a full one
+// goes through the overflow policy instead of stalling a producer that holds
+// the pool lock.
+template <typename policy_t>
+size_t basic_thread_pool<policy_t>::admission_capacity() const
+{
+	if constexpr (shared_queue::bound != 0) {
+		return m_backpressure.capacity == 0 ? shared_queue::bound : std::min(m_backpressure.capacity, shared_queue::bound);
+	}
+	return m_backpressure.capacity;
+}
+
+template <typename policy_t>
+bool basic_thread_pool<policy_t>::try_reserve(const size_t count, size_t& pending)
+{
+	size_t capacity = admission_capacity();
+	size_t current = m_pending_tasks.load();
+	do
+	{
+		if (current != 0 && current + count > capacity)
 		{
-			m_workers.clear();
-			m_terminated = false;
-			m_initialized = false;
-			return;
+			return false;
+		}
+	} while (!m_pending_tasks.compare_exchange_weak(current, current + count));
+	pending = current + count;
+	return true;
+}
+
+// Takes whatever room is left for up to count tasks; 0 if there is none.
+template <typename policy_t>
+size_t basic_thread_pool<policy_t>::reserve_part(const size_t count, size_t& pending)
+{
+	size_t capacity = admission_capacity();
+	size_t current = m_pending_tasks.load();
+	size_t taken = 0;
+	do
+	{
+		if (current >= capacity)
+		{
+			return 0;
 		}
+		taken = std::min(count, capacity - current);
+	} while (!m_pending_tasks.compare_exchange_weak(current, current + taken));
+	pending = current + taken;
+	return taken;
+}
+
+template <typename policy_t>
+void basic_thread_pool<policy_t>::raise_pending(const size_t count)
+{
+	crossed_high(m_pending_tasks.fetch_add(count) + count);
+}
+
+// Every worker that takes tasks off a queue goes through here, so this is
+// where the low watermark is crossed and blocked producers learn about free
+// room.
+template <typename policy_t>
+size_t basic_thread_pool<policy_t>::release_pending(const size_t count)
+{
+	size_t pending = m_pending_tasks.fetch_sub(count) - count;
+	if (m_above_high.load(std::memory_order_relaxed) && pending <= m_backpressure.low_watermark && m_above_high.exchange(false)) {
+		m_low_depth.store(pending, std::memory_order_relaxed);
+		m_watermark_events.fetch_or(2);
 	}
-	m_task_waiter.notify_all();
-	for (std::thread& worker : m_workers)
+	if (m_blocked_producers.load() != 0)
 	{
-		worker.join();
+		std::lock_guard<std::mutex> lock(m_space_mutex);
+		m_space_signal.notify_all();
 	}
-	m_workers.clear();
-	m_terminated = false;
-	m_initialized = false;
+	return pending;
 }
 
-void thread_pool::debug_terminate() {
-	m_print_lock.lock();
+template <typename policy_t>
+void basic_thread_pool<policy_t>::crossed_high(const size_t pending)
+{
+	if (m_backpressure.high_watermark == 0 || pending < m_backpressure.high_watermark || m_above_high.exchange(true)) {
+		return;
+	}
+	m_high_depth.store(pending, std::memory_order_relaxed);
+	m_watermark_events.fetch_or(1);
+}
 
-	printf("TRM: No tasks left, terminating.\n\n");
-	printf("====DEBUG INFO====\n");
-	printf("Tasks added: %zu\n", m_tasks.task_count());
-	printf("Tasks processed: %zu\n", m_tasks_processed);
-	printf("Total queue wait time: %.3f ms\n", m_wait_time);
-	printf("Average queue wait time: %.3f ms\n", m_wait_time / m_tasks_processed);
-	printf("Average queue length: %.3f tasks\n", (double)m_avg_queue_len / (double)m_avg_read_cnt);
+// Runs the callbacks for the crossings recorded since the last call. Must not
+// be called with the pool lock held. If the queue went both ways meanwhile,
+// they fire in the order that leaves the reported state matching the current
+// one.
+template <typename policy_t>
+void basic_thread_pool<policy_t>::notify_watermarks()
+{
+	if (m_watermark_events.load(std::memory_order_relaxed) == 0) {
+		return;
+	}
+	uint32_t events = m_watermark_events.exchange(0);
+	bool high_last = m_above_high.load();
+	for (uint32_t event : { high_last ? 2u : 1u, high_last ? 1u : 2u })
+	{
+		if ((events & event) == 0) {
+			continue;
+		}
+		if (event == 1 && m_backpressure.on_high_watermark) {
+			m_backpressure.on_high_watermark(m_high_depth.load(std::memory_order_relaxed));
+		}
+		if (event == 2 && m_backpressure.on_low_watermark) {
+			m_backpressure.on_low_watermark(m_low_depth.load(std::memory_order_relaxed));
+		}
+	}
+}
 
-	m_print_lock.unlock();
-}
\ No newline at end of file
+// Evicts the task a full pool can best afford to lose: the longest-waiting
+// one of the least urgent priority in the shared queue or, failing that, the
+// oldest on a domain queue or a worker's deque, and hands it to the caller
+// to destroy under an abandon_reason.
+template <typename policy_t>
+bool basic_thread_pool<policy_t>::drop_queued_task(queued_task& evicted)
+{
+	size_t task_id = 0;
+	bool dropped = m_tasks.pop_lowest(evicted, task_id);
+	stealing_task* stolen = nullptr;
+	size_t ignored_id = 0;
+	for (size_t domain = 0; !dropped && domain < m_domains.size(); domain++)
+	{
+		dropped = m_domains[domain]->tasks.pop(stolen, ignored_id);
+	}
+	for (size_t worker = 0; !dropped && worker < m_worker_states.size(); worker++)
+	{
+		dropped = m_worker_states[worker]->deque.steal(stolen);
+	}
+	if (!dropped)
+	{
+		return false;
+	}
+	if (stolen != nullptr)
+	{
+		task_id = stolen->id;
+		evicted = std::move(stolen->task);
+		delete stolen;
+	}
+	erase_status(task_id);
+	m_tasks_dropped.fetch_add(1, std::memory_order_relaxed);
+	release_pending(1);
+	if (debug_enabled()) {
+		m_print_lock.lock();
+		printf("ADD: Task ID %2zu was dropped to make room.\n", task_id);
+		m_print_lock.unlock();
+	}
+	return true;
+}
+
+template <typename policy_t>
+void basic_thread_pool<policy_t>::wake_blocked_producers()
+{
+	std::lock_guard<std::mutex> lock(m_space_mutex);
+	m_space_signal.notify_all();
+}
+
+// False if the pool is not running.
+template <typename policy_t>
+bool basic_thread_pool<policy_t>::schedule_timer(timer_entry&& entry)
+{
+	std::lock_guard<std::mutex> lock(m_timer_mutex);
+	if (m_timers_closed)
+	{
+		return false;
+	}
+	if (!m_timer_thread.joinable())
+	{
+		m_timer_thread = std::thread(&basic_thread_pool::timer_routine, this);
+	}
+	bool earlier = entry.due < m_timers.next_due();
+	std::chrono::steady_clock::time_point due = entry.due;
+	m_timers.schedule(due, std::move(entry));
+	if (earlier)
+	{
+		m_timer_signal.notify_one();
+	}
+	return true;
+}
+
+// Sleeps until the next occupied tick, then feeds everything due to the
+// shared queue in one batch. A periodic job whose previous run has not
+// finished skips this run; one that fell behind starts counting again from
+// now rather than firing the missed runs back to back.
+template <typename policy_t>
+void basic_thread_pool<policy_t>::timer_routine()
+{
+	std::vector<timer_entry> expired;
+	std::vector<typename shared_queue::reserved_task> due;
+	std::unique_lock<std::mutex> lock(m_timer_mutex);
+	while (!m_timers_closed)
+	{
+		std::chrono::steady_clock::time_point next = m_timers.next_due();
+		if (next == std::chrono::steady_clock::time_point::max())
+		{
+			m_timer_signal.wait(lock);
+		}
+		else
+		{
+			m_timer_signal.wait_until(lock, next);
+		}
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		m_timers.advance(now, expired);
+		for (timer_entry& entry : expired)
+		{
+			if (!entry.periodic)
+			{
+				size_t level = static_cast<size_t>(entry.task.priority);
+				due.push_back(typename shared_queue::reserved_task{ std::move(entry.task), entry.id, level });
+				continue;
+			}
+			periodic_job& job = *entry.periodic;
+			if (job.cancelled->load())
+			{
+				continue;
+			}
+			if (!job.running.exchange(true))
+			{
+				// running is cleared even if the task throws, or the job would
+				// never run again.
+				task_type run = [job = entry.periodic]() -> size_t {
+					struct finished { periodic_job& job; ~finished() { job.running = false; } } _{ *job };
+					return job->task();
+				};
+				due.push_back(typename shared_queue::reserved_task{ queued_task{ std::move(run), now, task_priority::normal }, m_tasks.reserve_id(), static_cast<size_t>(task_priority::normal) });
+			}
+			entry.due += job.interval;
+			if (entry.due <= now)
+			{
+				entry.due = now + job.interval;
+			}
+			std::chrono::steady_clock::time_point again = entry.due;
+			m_timers.schedule(again, std::move(entry));
+		}
+		expired.clear();
+		if (due.empty())
+		{
+			continue;
+		}
+		lock.unlock();
+		bool queued = enqueue_due(due);
+		lock.lock();
+		if (!queued)
+		{
+			// The pool is stopping: leave the tasks to close_timers() or
+			// take_queued() and stop servicing the wheel.
+			for (typename shared_queue::reserved_task& reserved : due)
+			{
+				queued_task& task = reserved.task;
+				m_timers.schedule(now, timer_entry{ reserved.id, std::move(task), nullptr, now });
+			}
+			m_timer_signal.wait(lock, [this] { return m_timers_closed; });
+		}
+		due.clear();
+	}
+}
+
+// Holds the pool lock shared so that terminate() cannot mark the pool
+// stopped, and its workers leave, between the check and the enqueue.
+template <typename policy_t>
+bool basic_thread_pool<policy_t>::enqueue_due(std::vector<typename shared_queue::reserved_task>& due)
+{
+	struct flush { basic_thread_pool& pool; ~flush() { pool.notify_watermarks(); } } watermarks{ *this };
+	read_lock _(m_rw_lock);
+	if (!working_unsafe())
+	{
+		return false;
+	}
+	std::chrono::steady_clock::time_point queued_at;
+	if (collecting_metrics() || tracing()) {
+		queued_at = std::chrono::steady_clock::now();
+	}
+	for (typename shared_queue::reserved_task& reserved : due)
+	{
+		reserved.task.queued_at = queued_at;
+	}
+	raise_pending(due.size());
+	m_tasks.emplace_reserved(due);
+	for (typename shared_queue::reserved_task& reserved : due)
+	{
+		update_status(reserved.id, [](TaskStatus&) {});
+		if (tracing()) {
+			m_trace->record(trace_event::queued, reserved.id, m_trace->timestamp(queued_at));
+		}
+	}
+	wake_workers(due.size());
+	return true;
+}
+
+// Moves the one-shot tasks still on the wheel into taken and drops the
+// periodic jobs.
+template <typename policy_t>
+void basic_thread_pool<policy_t>::take_timers(std::vector<unstarted_task>& taken)
+{
+	std::vector<timer_entry> pending;
+	{
+		std::lock_guard<std::mutex> lock(m_timer_mutex);
+		m_timers.clear(pending);
+	}
+	for (timer_entry& entry : pending)
+	{
+		if (!entry.periodic)
+		{
+			erase_status(entry.id);
+			taken.push_back(unstarted_task{ entry.id, entry.task.priority, std::move(entry.task.task) });
+		}
+	}
+}
+
+// Called once the workers are joined. One-shot tasks still on the wheel run
+// now, on the calling thread, as terminate() runs everything it was given;
+// periodic jobs are dropped. A coroutine sleeping on the wheel continues here.
+template <typename policy_t>
+void basic_thread_pool<policy_t>::close_timers()
+{
+	std::vector<timer_entry> pending;
+	{
+		std::lock_guard<std::mutex> lock(m_timer_mutex);
+		m_timers_closed = true;
+	}
+	m_timer_signal.notify_one();
+	if (m_timer_thread.joinable())
+	{
+		m_timer_thread.join();
+	}
+	{
+		std::lock_guard<std::mutex> lock(m_timer_mutex);
+		m_timers.clear(pending);
+	}
+	for (timer_entry& entry : pending)
+	{
+		if (entry.periodic)
+		{
+			continue;
+		}
+		run_on_caller(entry.id, entry.task.task);
+	}
+}
+
+// Fills m_worker_cpus (the pin set of each worker, empty for none),
+// m_worker_domain and m_cpu_domain, and creates one domain per node in use.
+template <typename policy_t>
+void basic_thread_pool<policy_t>::place_workers(const pool_config& config)
+{
+	size_t worker_count = config.worker_count;
+	m_worker_cpus.assign(worker_count, {});
+	m_worker_domain.assign(worker_count, 0);
+	m_cpu_domain.clear();
+	m_domains.clear();
+	if (config.affinity == worker_affinity::none || worker_count == 0)
+	{
+		m_domains.emplace_back(new scheduler_domain);
+		return;
+	}
+	std::vector<numa_node> nodes = detect_numa_nodes();
+	std::vector<size_t> worker_node(worker_count);
+	if (config.affinity == worker_affinity::core)
+	{
+		std::vector<std::pair<size_t, size_t>> cpus;
+		for (size_t node = 0; node < nodes.size(); node++)
+		{
+			for (size_t cpu : nodes[node].cpus)
+			{
+				cpus.emplace_back(cpu, node);
+			}
+		}
+		for (size_t id = 0; id < worker_count; id++)
+		{
+			m_worker_cpus[id] = { cpus[id % cpus.size()].first };
+			worker_node[id] = cpus[id % cpus.size()].second;
+		}
+	}
+	else
+	{
+		for (size_t id = 0; id < worker_count; id++)
+		{
+			worker_node[id] = id * nodes.size() / worker_count;
+			m_worker_cpus[id] = nodes[worker_node[id]].cpus;
+		}
+	}
+	std::vector<size_t> node_domain(nodes.size(), SIZE_MAX);
+	for (size_t id = 0; id < worker_count; id++)
+	{
+		size_t& domain = node_domain[worker_node[id]];
+		if (domain == SIZE_MAX)
+		{
+			domain = m_domains.size();
+			m_domains.emplace_back(new scheduler_domain);
+		}
+		m_worker_domain[id] = domain;
+	}
+	for (size_t node = 0; node < nodes.size(); node++)
+	{
+		for (size_t cpu : nodes[node].cpus)
+		{
+			if (cpu >= m_cpu_domain.size())
+			{
+				m_cpu_domain.resize(cpu + 1, SIZE_MAX);
+			}
+			m_cpu_domain[cpu] = node_domain[node];
+		}
+	}
+}
+
+template <typename policy_t>
+void basic_thread_pool<policy_t>::pin_worker(const size_t index)
+{
+	if (!m_worker_cpus[index].empty() && !pin_current_thread(m_worker_cpus[index]) && debug_enabled()) {
+		m_print_lock.lock();
+		printf("STR: Could not pin worker %zu.\n", index);
+		m_print_lock.unlock();
+	}
+}
+
+// The domain of the CPU the caller runs on, or round robin if that node has
+// no workers.
+template <typename policy_t>
+size_t basic_thread_pool<policy_t>::caller_domain()
+{
+	size_t cpu = current_cpu();
+	if (cpu < m_cpu_domain.size() && m_cpu_domain[cpu] != SIZE_MAX)
+	{
+		return m_cpu_domain[cpu];
+	}
+	return m_next_domain.fetch_add(1, std::memory_order_relaxed) % m_domains.size();
+}
+
+template <typename policy_t>
+void basic_thread_pool<policy_t>::routine(const size_t index)
+{
+	pin_worker(index);
+	if (tracing()) {
+		m_trace->name_current_thread("worker " + std::to_string(index));
+	}
+	s_current_pool = this;
+	s_worker_index = index;
+	while (true)
+	{
+		size_t task_id = -1;
+		size_t queue_len = 0;
+		queued_task task;
+		if (!take_shared_task(index, task, task_id, queue_len))
+		{
+			if (m_terminated && m_pending_tasks.load() == 0)
+			{
+				worker_exited(index);
+				return;
+			}
+			idle_wait();
+			if (retire_requested(index))
+			{
+				return;
+			}
+			continue;
+		}
+		run_task(index, task_id, task, queue_len);
+	}
+}
+
+// global_queue mode: the rest of an earlier batch, the shared queue, then the
+// batch rests other workers left on their deques. A batch is kept on the
+// worker's own deque, so a waiting task can still run it through
+// run_pending_task(), idle workers can steal it and take_queued() hands it
+// back; its tasks stay pending until one of them is started.
+template <typename policy_t>
+bool basic_thread_pool<policy_t>::take_shared_task(const size_t index, queued_task& task, size_t& task_id, size_t& queue_len)
+{
+	worker_state& self = *m_worker_states[index];
+	stealing_task* acquired = nullptr;
+	if (!self.deque.pop(acquired))
+	{
+		if (m_max_batch == 1)
+		{
+			if (m_tasks.pop(task, task_id, queue_len))
+			{
+				release_pending(1);
+				return true;
+			}
+		}
+		else if (m_tasks.pop_batch(self.batch, self.batch_ids, m_max_batch, std::max<size_t>(m_active_workers.load(), 1)) > 0)
+		{
+			task = std::move(self.batch[0]);
+			task_id = self.batch_ids[0];
+			// Newest first, so pop() hands them back in queue order.
+			for (size_t extra = self.batch.size(); extra-- > 1; )
+			{
+				self.deque.push(new stealing_task{ self.batch_ids[extra], std::move(self.batch[extra]) });
+			}
+			self.batch.clear();
+			self.batch_ids.clear();
+			queue_len = release_pending(1);
+			return true;
+		}
+		if (!steal_task(self, self.near_victims, acquired) && !steal_task(self, self.far_victims, acquired))
+		{
+			return false;
+		}
+	}
+	task_id = acquired->id;
+	task = std::move(acquired->task);
+	delete acquired;
+	queue_len = release_pending(1);
+	return true;
+}
+
+template <typename policy_t>
+void basic_thread_pool<policy_t>::stealing_routine(const size_t index)
+{
+	pin_worker(index);
+	if (tracing()) {
+		m_trace->name_current_thread("worker " + std::to_string(index));
+	}
+	s_current_pool = this;
+	s_worker_index = index;
+	while (true)
+	{
+		size_t task_id = -1;
+		queued_task task;
+		if (!acquire_task(index, task, task_id))
+		{
+			if (m_terminated && m_pending_tasks.load() == 0)
+			{
+				worker_exited(index);
+				return;
+			}
+			idle_wait();
+			if (retire_requested(index))
+			{
+				return;
+			}
+			continue;
+		}
+		size_t queue_len = release_pending(1);
+		run_task(index, task_id, task, queue_len);
+	}
+}
+
+// Own deque, own domain's queue, the shared queue, same-domain victims, then
+// other domains' victims and queues.
+template <typename policy_t>
+bool basic_thread_pool<policy_t>::acquire_task(const size_t index, queued_task& task, size_t& task_id)
+{
+	worker_state& self = *m_worker_states[index];
+	stealing_task* acquired = nullptr;
+	size_t ignored_id = 0;
+	bool local = self.deque.pop(acquired)
+		|| (m_domains.size() > 1 && m_domains[self.domain]->tasks.pop(acquired, ignored_id));
+	if (!local)
+	{
+		if (m_max_batch > 1)
+		{
+			// Keep the first task and park the rest on our own deque, where idle
+			// workers can still steal them.
+			if (m_tasks.pop_batch(self.batch, self.batch_ids, m_max_batch, std::max<size_t>(m_active_workers.load(), 1)) > 0)
+			{
+				task = std::move(self.batch[0]);
+				task_id = self.batch_ids[0];
+				for (size_t extra = 1; extra < self.batch.size(); extra++)
+				{
+					self.deque.push(new stealing_task{ self.batch_ids[extra], std::move(self.batch[extra]) });
+				}
+				self.batch.clear();
+				self.batch_ids.clear();
+				return true;
+			}
+		}
+		else if (m_tasks.pop(task, task_id))
+		{
+			return true;
+		}
+		if (!steal_task(self, self.near_victims, acquired) && !steal_task(self, self.far_victims, acquired))
+		{
+			for (size_t domain = 0; domain < m_domains.size() && acquired == nullptr; domain++)
+			{
+				if (domain == self.domain || !m_domains[domain]->tasks.pop(acquired, ignored_id))
+				{
+					acquired = nullptr;
+				}
+			}
+			if (acquired == nullptr)
+			{
+				return false;
+			}
+		}
+	}
+	task_id = acquired->id;
+	task = std::move(acquired->task);
+	delete acquired;
+	return true;
+}
+
+template <typename policy_t>
+bool basic_thread_pool<policy_t>::steal_task(worker_state& self, const std::vector<size_t>& victims, stealing_task*& acquired)
+{
+	if (victims.empty())
+	{
+		return false;
+	}
+	size_t start = self.random() % victims.size();
+	for (size_t attempt = 0; attempt < victims.size(); attempt++)
+	{
+		if (m_worker_states[victims[(start + attempt) % victims.size()]]->deque.steal(acquired))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+template <typename policy_t>
+bool basic_thread_pool<policy_t>::work_available() const
+{
+	return m_terminated.load() || m_pending_tasks.load() > 0 || m_retire_requests.load() > 0;
+}
+
+template <typename policy_t>
+void basic_thread_pool<policy_t>::idle_wait()
+{
+	for (size_t spin = 0; spin < m_idle.spin_count; spin++)
+	{
+		if (work_available())
+		{
+			return;
+		}
+		cpu_relax();
+	}
+	for (size_t round = 0; round < m_idle.yield_count; round++)
+	{
+		if (work_available())
+		{
+			return;
+		}
+		std::this_thread::yield();
+	}
+	// Blocks this worker freed for other threads should not wait out the nap.
+	slab_cache::release_idle();
+	// A producer bumps m_pending_tasks before reading m_sleeping_workers, and we
+	// register here before re-reading m_pending_tasks (all seq_cst), so either
+	// it sees us parked or we see its task and skip the wait.
+	m_sleeping_workers.fetch_add(1);
+	uint32_t epoch = m_wake_epoch.load();
+	if (!work_available())
+	{
+		m_wake_epoch.wait(epoch);
+	}
+	m_sleeping_workers.fetch_sub(1);
+}
+
+template <typename policy_t>
+void basic_thread_pool<policy_t>::wake_workers(const size_t count)
+{
+	// A waiting worker may be the one to run the new tasks.
+	wake_waiters();
+	size_t sleeping = m_sleeping_workers.load();
+	if (sleeping == 0)
+	{
+		return;
+	}
+	m_wake_epoch.fetch_add(1);
+	if (count >= sleeping)
+	{
+		m_wake_epoch.notify_all();
+		return;
+	}
+	for (size_t index = 0; index < count; index++)
+	{
+		m_wake_epoch.notify_one();
+	}
+}
+
+template <typename policy_t>
+void basic_thread_pool<policy_t>::wake_all_workers()
+{
+	m_wake_epoch.fetch_add(1);
+	m_wake_epoch.notify_all();
+	wake_waiters();
+}
+
+template <typename policy_t>
+void basic_thread_pool<policy_t>::wake_waiters()
+{
+	if (m_waiting_threads.load() == 0) {
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> _(m_waiter_mutex);
+		m_waiter_epoch++;
+	}
+	m_waiter_signal.notify_all();
+}
+
+// Whatever is still queued once the workers are gone is destroyed unrun,
+// which breaks the futures of submitted tasks, and the pending count starts
+// over from zero.
+template <typename policy_t>
+void basic_thread_pool<policy_t>::discard_queued_tasks()
+{
+	queued_task task;
+	size_t task_id = 0;
+	while (m_tasks.pop(task, task_id))
+	{
+		erase_status(task_id);
+		task = queued_task();
+	}
+	stealing_task* discarded = nullptr;
+	for (std::unique_ptr<worker_state>& state : m_worker_states)
+	{
+		while (state->deque.steal(discarded))
+		{
+			delete discarded;
+		}
+	}
+	size_t ignored_id = 0;
+	for (std::unique_ptr<scheduler_domain>& domain : m_domains)
+	{
+		while (domain->tasks.pop(discarded, ignored_id))
+		{
+			delete discarded;
+		}
+	}
+	m_pending_tasks = 0;
+}
+
+// Takes and runs one task on behalf of the calling worker; false if the caller
+// is not one of this pool's workers or there was nothing to take.
+template <typename policy_t>
+bool basic_thread_pool<policy_t>::run_pending_task()
+{
+	if (!in_worker_thread()) {
+		return false;
+	}
+	size_t index = s_worker_index;
+	size_t task_id = -1;
+	size_t queue_len = 0;
+	queued_task task;
+	if (m_mode == scheduler_mode::work_stealing)
+	{
+		if (!acquire_task(index, task, task_id)) {
+			return false;
+		}
+		queue_len = release_pending(1);
+	}
+	else if (!take_shared_task(index, task, task_id, queue_len)) {
+		return false;
+	}
+	run_task(index, task_id, task, queue_len);
+	return true;
+}
+
+template <typename policy_t>
+void basic_thread_pool<policy_t>::run_task(const size_t index, const size_t task_id, queued_task& task, const size_t queue_len)
+{
+	notify_watermarks();
+	update_status(task_id, [](TaskStatus& status) {
+		status.status = TaskStatus::Status::Working;
+		});
+	std::chrono::steady_clock::time_point started_at;
+	if (collecting_metrics() || tracing()) {
+		started_at = std::chrono::steady_clock::now();
+	}
+	uint64_t wait = collecting_metrics() ? duration_cast<nanoseconds>(started_at - task.queued_at).count() : 0;
+	if (tracing()) {
+		m_trace->record(trace_event::started, task_id, m_trace->timestamp(started_at));
+	}
+	if (debug_enabled()) {
+		m_print_lock.lock();
+		printf("WRK: Task ID %2zu began working. Queue wait time %.3f miliseconds.\n", task_id, wait * 1e-6);
+		m_print_lock.unlock();
+	}
+	size_t result = 0;
+	std::exception_ptr error;
+	try {
+		result = task.task();
+	}
+	catch (...) {
+		error = std::current_exception();
+	}
+	wake_waiters();
+	update_status(task_id, [result, failed = error != nullptr](TaskStatus& status) {
+		status.status = failed ? TaskStatus::Status::Failed : TaskStatus::Status::Finished;
+		status.result = result;
+		});
+	if (error) {
+		task_failed(index, task_id, std::move(error));
+	}
+	if (tracing()) {
+		m_trace->record(trace_event::finished, task_id);
+	}
+	if (collecting_metrics()) {
+		uint64_t execution = duration_cast<nanoseconds>(std::chrono::steady_clock::now() - started_at).count();
+		worker_metrics& metrics = *m_worker_metrics[index];
+		metrics.tasks_executed.add();
+		metrics.queue_length_sum.add(queue_len);
+		metrics.execution.record(execution);
+		metrics.queue_wait.record(wait);
+		metrics.queue_wait_by_priority[static_cast<size_t>(task.priority)].record(wait);
+		metrics.end_to_end.record(wait + execution);
+	}
+	if (debug_enabled()) {
+		m_print_lock.lock();
+		printf("END: Task ID %2zu returned %zu.\n", task_id, result);
+		m_print_lock.unlock();
+	}
+}
+// index is -1 for a task that ran on some other thread; only the workers'
+// metrics count failures.
+template <typename policy_t>
+void basic_thread_pool<policy_t>::task_failed(const size_t index, const size_t task_id, std::exception_ptr error)
+{
+	if (collecting_metrics() && index < m_worker_metrics.size()) {
+		m_worker_metrics[index]->tasks_failed.add();
+	}
+	if (debug_enabled()) {
+		m_print_lock.lock();
+		printf("ERR: Task ID %2zu threw an exception.\n", task_id);
+		m_print_lock.unlock();
+	}
+	if (m_error_handler) {
+		m_error_handler(task_id, std::move(error));
+	}
+}
+
+// Runs a task outside the workers, e.g. under caller_runs or a delayed one
+// that terminate() flushes, with the same exception capture and status
+// update as run_task().
+template <typename policy_t>
+size_t basic_thread_pool<policy_t>::run_on_caller(const size_t task_id, task_type& task)
+{
+	size_t result = 0;
+	std::exception_ptr error;
+	try {
+		result = task();
+	}
+	catch (...) {
+		error = std::current_exception();
+	}
+	wake_waiters();
+	update_status(task_id, [result, failed = error != nullptr](TaskStatus& status) {
+		status.status = failed ? TaskStatus::Status::Failed : TaskStatus::Status::Finished;
+		status.result = result;
+		});
+	if (error) {
+		task_failed(size_t(-1), task_id, std::move(error));
+	}
+	return result;
+}
+
+// The reason is the pool's, if it discards the task under an abandon_reason.
+template <typename policy_t>
+basic_thread_pool<policy_t>::coroutine_resume::~coroutine_resume()
+{
+	if (!handle) {
+		return;
+	}
+	*error = abandon_reason::current();
+	if (!*error) {
+		*error = std::make_exception_ptr(std::future_error(std::future_errc::broken_promise));
+	}
+	std::exchange(handle, nullptr).resume();
+}
+
+// On a pool that does not take tasks the coroutine just continues on the
+// calling thread. Nothing may touch the awaiter once the task is queued: a
+// worker can resume, and finish, the coroutine before add_task() returns.
+template <typename policy_t>
+bool basic_thread_pool<policy_t>::schedule_awaiter::await_suspend(std::coroutine_handle<> handle)
+{
+	coroutine_resume resume(handle, &error);
+	// A task the pool took and then discarded has resumed the coroutine.
+	if (pool.add_task(priority, std::move(resume)) != size_t(-1) || !resume.handle) {
+		return true;
+	}
+	resume.handle = nullptr;
+	return false;
+}
+
+// Without a running pool to wake it the coroutine continues at once on the
+// calling thread, as schedule() does, rather than sleeping there.
+template <typename policy_t>
+bool basic_thread_pool<policy_t>::timer_awaiter::await_suspend(std::coroutine_handle<> handle)
+{
+	coroutine_resume resume(handle, &error);
+	// A task the pool took and then discarded has resumed the coroutine.
+	if (pool.add_task_at(due, priority, std::move(resume)) != size_t(-1) || !resume.handle) {
+		return true;
+	}
+	resume.handle = nullptr;
+	return false;
+}
+
+template <typename policy_t>
+template <typename rep, typename period>
+typename basic_thread_pool<policy_t>::timer_awaiter basic_thread_pool<policy_t>::sleep_for(const std::chrono::duration<rep, period>& delay, task_priority priority)
+{
+	return sleep_until(std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(delay), priority);
+}
+
+template <typename policy_t>
+template <typename task_t, typename... arguments>
+size_t basic_thread_pool<policy_t>::add_task(task_t&& task, arguments&&... parameters)
+{
+	return add_task(task_priority::normal, std::forward<task_t>(task), std::forward<arguments>(parameters)...);
+}
+
+// Returns -1 if the pool does not take tasks or the backpressure policy
+// refused this one; try_add_task() tells the two apart. A refused task and
+// its arguments are left unmoved.
+template <typename policy_t>
+template <typename task_t, typename... arguments>
+size_t basic_thread_pool<policy_t>::add_task(task_priority priority, task_t&& task, arguments&&... parameters)
+{
+	return try_add_task(priority, std::forward<task_t>(task), std::forward<arguments>(parameters)...).id;
+}
+
+template <typename policy_t>
+template <typename task_t, typename... arguments>
+submit_result basic_thread_pool<policy_t>::try_add_task(task_t&& task, arguments&&... parameters)
+{
+	return try_add_task(task_priority::normal, std::forward<task_t>(task), std::forward<arguments>(parameters)...);
+}
+
+// Only normal-priority tasks go onto a work-stealing worker's own deque; the
+// others always go through the shared multi-level queue.
+template <typename policy_t>
+template <typename task_t, typename... arguments>
+submit_result basic_thread_pool<policy_t>::try_add_task(task_priority priority, task_t&& task, arguments&&... parameters)
+{
+	// Held until the task is queued, so terminate() cannot let the workers
+	// leave between the check and the enqueue.
+	struct flush { basic_thread_pool& pool; ~flush() { pool.notify_watermarks(); } } watermarks{ *this };
+	read_lock lock(m_rw_lock);
+	if (!working_unsafe()) {
+		return submit_result{ submit_status::stopped };
+	}
+	// Nothing is moved from task or parameters until the task is let in, so a
+	// refused callable is still the caller's.
+	admission admitted = admit(1, lock);
+	if (admitted == admission::stopped) {
+		return submit_result{ submit_status::stopped };
+	}
+	if (admitted == admission::full) {
+		return submit_result{ submit_status::queue_full };
+	}
+	task_type bind = [function = std::forward<task_t>(task), ...values = std::forward<arguments>(parameters)]() mutable -> size_t {
+		return std::invoke(std::move(function), std::move(values)...);
+	};
+	size_t id = 0;
+	if (admitted == admission::run_here) {
+		id = m_tasks.reserve_id();
+		run_on_caller(id, bind);
+		return submit_result{ submit_status::ran_on_caller, id };
+	}
+	std::chrono::steady_clock::time_point queued_at;
+	if (collecting_metrics() || tracing()) {
+		queued_at = std::chrono::steady_clock::now();
+	}
+	queued_task record{ std::move(bind), queued_at, priority };
+	if (m_mode == scheduler_mode::work_stealing && s_current_pool == this && priority == task_priority::normal)
+	{
+		id = m_tasks.reserve_id();
+		m_worker_states[s_worker_index]->deque.push(new stealing_task{ id, std::move(record) });
+	}
+	else if (m_mode == scheduler_mode::work_stealing && m_domains.size() > 1 && priority == task_priority::normal)
+	{
+		id = m_tasks.reserve_id();
+		m_domains[caller_domain()]->tasks.emplace(new stealing_task{ id, std::move(record) });
+	}
+	else
+	{
+		id = m_tasks.emplace_prioritized(static_cast<size_t>(priority), std::move(record));
+	}
+	// A worker may already have picked the task up; update() only creates the
+	// Waiting record if it does not exist yet.
+	update_status(id, [](TaskStatus&) {});
+	if (tracing()) {
+		m_trace->record(trace_event::queued, id, m_trace->timestamp(queued_at));
+	}
+	wake_workers(1);
+	if (debug_enabled()) {
+		m_print_lock.lock();
+		printf("ADD: Task ID %2zu was added to the queue.\n", id);
+		m_print_lock.unlock();
+	}
+	return submit_result{ submit_status::queued, id };
+}
+
+// Enqueues the callables in [first, last), moving from them, with one queue
+// lock and one wakeup round. Returns the id of the first task; the batch has
+// consecutive ids.
+template <typename policy_t>
+template <typename iterator_t>
+size_t basic_thread_pool<policy_t>::add_tasks(iterator_t first, iterator_t last)
+{
+	struct flush { basic_thread_pool& pool; ~flush() { pool.notify_watermarks(); } } watermarks{ *this };
+	read_lock lock(m_rw_lock);
+	if (!working_unsafe()) {
+		return -1;
+	}
+	size_t count = std::distance(first, last);
+	if (count == 0) {
+		return m_tasks.task_count();
+	}
+	size_t id = 0;
+	size_t queued = count;
+	switch (admit(count, lock, &queued))
+	{
+	case admission::stopped:
+	case admission::full:
+		return -1;
+	case admission::run_here:
+		id = m_tasks.reserve_id(count);
+		for (size_t index = 0; first != last; ++first, index++)
+		{
+			task_type job(std::move(*first));
+			run_on_caller(id + index, job);
+		}
+		return id;
+	case admission::queued:
+		break;
+	}
+	// Under caller_runs only the first queued tasks may have got in; the rest
+	// run below once the lock is released, with the ids that follow theirs.
+	iterator_t split = std::next(first, queued);
+	std::chrono::steady_clock::time_point queued_at;
+	if (collecting_metrics() || tracing()) {
+		queued_at = std::chrono::steady_clock::now();
+	}
+	if (m_mode == scheduler_mode::work_stealing && s_current_pool == this)
+	{
+		work_stealing_deque<stealing_task*>& deque = m_worker_states[s_worker_index]->deque;
+		id = m_tasks.reserve_id(count);
+		for (size_t index = 0; first != split; ++first, index++)
+		{
+			deque.push(new stealing_task{ id + index, queued_task{ task_type(std::move(*first)), queued_at } });
+		}
+	}
+	else if (m_mode == scheduler_mode::work_stealing && m_domains.size() > 1)
+	{
+		std::vector<stealing_task*> batch;
+		batch.reserve(queued);
+		id = m_tasks.reserve_id(count);
+		for (size_t index = 0; first != split; ++first, index++)
+		{
+			batch.push_back(new stealing_task{ id + index, queued_task{ task_type(std::move(*first)), queued_at } });
+		}
+		m_domains[caller_domain()]->tasks.emplace_range(batch.begin(), batch.end());
+	}
+	else if (queued < count)
+	{
+		std::vector<typename shared_queue::reserved_task> batch;
+		batch.reserve(queued);
+		id = m_tasks.reserve_id(count);
+		for (size_t index = 0; first != split; ++first, index++)
+		{
+			batch.push_back(typename shared_queue::reserved_task{ queued_task{ task_type(std::move(*first)), queued_at }, id + index, static_cast<size_t>(task_priority::normal) });
+		}
+		m_tasks.emplace_reserved(batch);
+	}
+	else
+	{
+		std::vector<queued_task> batch;
+		batch.reserve(count);
+		for (; first != last; ++first)
+		{
+			batch.push_back(queued_task{ task_type(std::move(*first)), queued_at });
+		}
+		id = m_tasks.emplace_range(batch.begin(), batch.end());
+	}
+	for (size_t index = 0; index < queued; index++)
+	{
+		update_status(id + index, [](TaskStatus&) {});
+		if (tracing()) {
+			m_trace->record(trace_event::queued, id + index, m_trace->timestamp(queued_at));
+		}
+	}
+	wake_workers(queued);
+	if (debug_enabled()) {
+		m_print_lock.lock();
+		printf("ADD: Task IDs %2zu-%zu were added to the queue.\n", id, id + queued - 1);
+		m_print_lock.unlock();
+	}
+	if (queued < count)
+	{
+		lock.unlock();
+		for (size_t index = queued; first != last; ++first, index++)
+		{
+			task_type job(std::move(*first));
+			run_on_caller(id + index, job);
+		}
+	}
+	return id;
+}
+
+template <typename policy_t>
+template <typename rep, typename period, typename task_t, typename... arguments>
+size_t basic_thread_pool<policy_t>::add_task_after(const std::chrono::duration<rep, period>& delay, task_t&& task, arguments&&... parameters)
+{
+	return add_task_at(std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(delay), std::forward<task_t>(task), std::forward<arguments>(parameters)...);
+}
+
+template <typename policy_t>
+template <typename task_t, typename... arguments>
+size_t basic_thread_pool<policy_t>::add_task_at(const std::chrono::steady_clock::time_point due, task_t&& task, arguments&&... parameters)
+{
+	return add_task_at(due, task_priority::normal, std::forward<task_t>(task), std::forward<arguments>(parameters)...);
+}
+
+// The task waits on the timer wheel, not on a worker, and is queued with its
+// priority once due. Its id is taken now, so get_status() reports it as
+// waiting meanwhile. Returns -1 if the pool does not take tasks.
+template <typename policy_t>
+template <typename task_t, typename... arguments>
+size_t basic_thread_pool<policy_t>::add_task_at(const std::chrono::steady_clock::time_point due, task_priority priority, task_t&& task, arguments&&... parameters)
+{
+	read_lock _(m_rw_lock);
+	if (!working_unsafe()) {
+		return -1;
+	}
+	auto bind = [function = std::forward<task_t>(task), ...values = std::forward<arguments>(parameters)]() mutable -> size_t {
+		return std::invoke(std::move(function), std::move(values)...);
+	};
+	size_t id = m_tasks.reserve_id();
+	update_status(id, [](TaskStatus&) {});
+	if (!schedule_timer(timer_entry{ id, queued_task{ std::move(bind), {}, priority }, nullptr, due })) {
+		erase_status(id);
+		return -1;
+	}
+	if (debug_enabled()) {
+		m_print_lock.lock();
+		printf("ADD: Task ID %2zu was scheduled.\n", id);
+		m_print_lock.unlock();
+	}
+	return id;
+}
+
+// Runs task(parameters...) every interval, starting one interval from now,
+// until the handle is cancelled or the pool terminates. The arguments are
+// kept and passed by reference to every run. interval is at least the timer
+// resolution of 1 ms.
+template <typename policy_t>
+template <typename rep, typename period, typename task_t, typename... arguments>
+typename basic_thread_pool<policy_t>::periodic_handle basic_thread_pool<policy_t>::add_periodic(const std::chrono::duration<rep, period>& interval, task_t&& task, arguments&&... parameters)
+{
+	{
+		read_lock _(m_rw_lock);
+		if (!working_unsafe()) {
+			return periodic_handle();
+		}
+	}
+	std::shared_ptr<periodic_job> job = std::make_shared<periodic_job>();
+	job->task = [function = std::forward<task_t>(task), ...values = std::forward<arguments>(parameters)]() mutable -> size_t {
+		return std::invoke(function, values...);
+	};
+	job->interval = std::max<std::chrono::steady_clock::duration>(std::chrono::duration_cast<std::chrono::steady_clock::duration>(interval), std::chrono::milliseconds(1));
+	job->cancelled = std::make_shared<std::atomic<bool>>(false);
+	periodic_handle handle(job->cancelled);
+	std::chrono::steady_clock::time_point first = std::chrono::steady_clock::now() + job->interval;
+	if (!schedule_timer(timer_entry{ 0, queued_task{}, std::move(job), first })) {
+		return periodic_handle();
+	}
+	return handle;
+}
+
+template <typename policy_t>
+template <typename task_t, typename... arguments>
+auto basic_thread_pool<policy_t>::submit(task_t&& task, arguments&&... parameters)
+{
+	return submit(task_priority::normal, std::forward<task_t>(task), std::forward<arguments>(parameters)...);
+}
+
+template <typename policy_t>
+template <typename task_t, typename... arguments>
+auto basic_thread_pool<policy_t>::submit(task_priority priority, task_t&& task, arguments&&... parameters)
+{
+	using result_t = std::invoke_result_t<std::decay_t<task_t>, std::decay_t<arguments>...>;
+	task_promise<result_t> promise;
+	task_future<result_t> future = promise.get_future();
+	add_task(priority, [promise = std::move(promise), function = std::forward<task_t>(task), ...values = std::forward<arguments>(parameters)]() mutable -> size_t {
+		try {
+			if constexpr (std::is_void_v<result_t>) {
+				std::invoke(std::move(function), std::move(values)...);
+				promise.set_value();
+			}
+			else {
+				promise.set_value(std::invoke(std::move(function), std::move(values)...));
+			}
+		}
+		catch (...) {
+			promise.set_exception(std::current_exception());
+		}
+		return 0;
+	});
+	return future;
+}
+
+// Waits for future. On one of this pool's workers it runs other queued tasks
+// in the meantime instead of blocking, so tasks can wait on the tasks they
+// submit without tying up a worker each or deadlocking a small pool. Tasks
+// run this way nest on the waiting worker's stack, at most
+// policy_t::wait_depth waits deep unless every worker is that deep; a wait
+// below that otherwise blocks the worker. In
+// global_queue mode they are taken oldest first, so recursive waits nest
+// about as deep as the queue is long; work_stealing mode takes the newest.
+template <typename policy_t>
+template <typename result_t>
+void basic_thread_pool<policy_t>::wait(const task_future<result_t>& future)
+{
+	if (!in_worker_thread()) {
+		future.wait();
+		return;
+	}
+	wait_until([&future] { return future.ready(); });
+}
+
+// Returns once done() holds. On one of this pool's workers it runs queued
+// tasks meanwhile, up to policy_t::wait_depth nested waits; with nothing to
+// run, and on any other thread, it sleeps until a task finishes or is queued.
+template <typename policy_t>
+template <typename predicate_t>
+void basic_thread_pool<policy_t>::wait_until(predicate_t&& done)
+{
+	wait_helping(done, [] { return false; });
+}
+
+// help() is tried before the pool's queues; it returns false once it has
+// nothing left to do.
+template <typename policy_t>
+template <typename predicate_t, typename help_t>
+void basic_thread_pool<policy_t>::wait_helping(predicate_t& done, help_t&& help)
+{
+	bool helping = in_worker_thread() && s_wait_depth < policy_t::wait_depth;
+	bool capped = in_worker_thread() && !helping;
+	// A worker counts as capped once, however many capped waits it nests.
+	struct nesting {
+		bool counted;
+		bool capped_here;
+		std::atomic<size_t>& capped_workers;
+		~nesting() { s_wait_depth -= counted; if (capped_here) { s_capped = false; capped_workers.fetch_sub(1); } }
+	} _{ helping, capped && !s_capped, m_capped_workers };
+	s_wait_depth += helping;
+	if (_.capped_here) {
+		s_capped = true;
+		m_capped_workers.fetch_add(1);
+	}
+	while (!done())
+	{
+		bool may_run = helping || (capped && m_capped_workers.load() >= m_active_workers.load());
+		if (!help() && !(may_run && run_pending_task())) {
+			park_waiter(done);
+		}
+	}
+}
+
+// Sleeps until wake_waiters() runs after the epoch is read. done() is checked
+// outside the lock, since it may itself submit; the timeout catches a done()
+// made true by something other than a pool task.
+template <typename policy_t>
+template <typename predicate_t>
+void basic_thread_pool<policy_t>::park_waiter(predicate_t& done)
+{
+	struct parked { std::atomic<size_t>& count; ~parked() { count.fetch_sub(1); } } _{ m_waiting_threads };
+	m_waiting_threads.fetch_add(1);
+	uint64_t epoch = 0;
+	{
+		std::lock_guard<std::mutex> lock(m_waiter_mutex);
+		epoch = m_waiter_epoch;
+	}
+	if (done()) {
+		return;
+	}
+	slab_cache::release_idle();
+	std::unique_lock<std::mutex> lock(m_waiter_mutex);
+	m_waiter_signal.wait_for(lock, std::chrono::milliseconds(1), [this, epoch] { return m_waiter_epoch != epoch; });
+}
+
+// Calls function(index) for every index in [first, last) on the pool's workers
+// and the calling thread, and returns when all calls have finished. grain is
+// the smallest piece worth handing to another thread; 0 picks one from the
+// range length and worker count.
+template <typename policy_t>
+template <std::integral index_t, typename function_t>
+void basic_thread_pool<policy_t>::parallel_for(const index_t first, const index_t last, function_t&& function, const size_t grain)
+{
+	size_t count = last > first ? static_cast<size_t>(last - first) : 0;
+	if (count == 0) {
+		return;
+	}
+	using job_t = for_range<index_t, std::remove_reference_t<function_t>>;
+	run_job(std::make_shared<job_t>(first, function), count, grain);
+}
+
+// Folds transform(index) for every index in [first, last) with combine, which
+// must be associative, and returns the result. identity must be a neutral
+// element of combine: every piece starts from it. Pieces are combined in index
+// order, so combine does not have to be commutative.
+template <typename policy_t>
+template <std::integral index_t, typename value_t, typename transform_t, typename combine_t>
+value_t basic_thread_pool<policy_t>::parallel_reduce(const index_t first, const index_t last, value_t identity, transform_t&& transform, combine_t&& combine, const size_t grain)
+{
+	size_t count = last > first ? static_cast<size_t>(last - first) : 0;
+	if (count == 0) {
+		return identity;
+	}
+	using job_t = reduce_range<index_t, value_t, std::remove_reference_t<transform_t>, std::remove_reference_t<combine_t>>;
+	std::shared_ptr<job_t> job = std::make_shared<job_t>(first, identity, transform, combine);
+	run_job(job, count, grain);
+	return job->collect();
+}
+
+template <typename policy_t>
+template <typename index_t, typename value_t, typename transform_t, typename combine_t>
+basic_thread_pool<policy_t>::reduce_range<index_t, value_t, transform_t, combine_t>::~reduce_range()
+{
+	for (partial* current = partials.load(); current != nullptr; )
+	{
+		partial* next = current->next;
+		delete current;
+		current = next;
+	}
+}
+
+// Publishes the value of the piece starting at piece_first on a lock-free list.
+template <typename policy_t>
+template <typename index_t, typename value_t, typename transform_t, typename combine_t>
+void basic_thread_pool<policy_t>::reduce_range<index_t, value_t, transform_t, combine_t>::finish(value_t& value, const size_t piece_first)
+{
+	partial* published = new partial{ piece_first, std::move(value), partials.load(std::memory_order_relaxed) };
+	while (!partials.compare_exchange_weak(published->next, published, std::memory_order_release, std::memory_order_relaxed))
+	{
+	}
+}
+
+template <typename policy_t>
+template <typename index_t, typename value_t, typename transform_t, typename combine_t>
+value_t basic_thread_pool<policy_t>::reduce_range<index_t, value_t, transform_t, combine_t>::collect()
+{
+	std::vector<partial*> ordered;
+	for (partial* current = partials.load(std::memory_order_acquire); current != nullptr; current = current->next)
+	{
+		ordered.push_back(current);
+	}
+	std::sort(ordered.begin(), ordered.end(), [](const partial* lhs, const partial* rhs) { return lhs->first < rhs->first; });
+	value_t result = identity;
+	for (partial* current : ordered)
+	{
+		result = combine(std::move(result), std::move(current->value));
+	}
+	return result;
+}
+
+template <typename policy_t>
+size_t basic_thread_pool<policy_t>::default_grain(const size_t count) const
+{
+	return std::max<size_t>(count / (8 * std::max<size_t>(m_active_workers.load(), 1)), 1);
+}
+
+// The caller runs the whole range itself, splitting off pieces as it goes,
+// then takes back any piece no helper has started and waits for the rest. A
+// piece is never left waiting on a helper task, so this cannot deadlock when
+// called from a worker or when the pool drops the helpers.
+template <typename policy_t>
+template <typename job_t>
+void basic_thread_pool<policy_t>::run_job(const std::shared_ptr<job_t>& job, const size_t count, const size_t grain)
+{
+	job->grain = grain == 0 ? default_grain(count) : grain;
+	job->outstanding.store(1, std::memory_order_relaxed);
+	run_range(job, range_piece{ 0, count });
+	auto done = [&job] { return job->outstanding.load(std::memory_order_acquire) == 0; };
+	wait_helping(done, [this, &job] { return take_range(job); });
+}
+
+// Lazy binary splitting: while the range is longer than the grain and no
+// earlier split-off piece is still waiting to be taken, hand the upper half to
+// a helper; otherwise run one grain and check again.
+template <typename policy_t>
+template <typename job_t>
+void basic_thread_pool<policy_t>::run_range(const std::shared_ptr<job_t>& job, const range_piece piece)
+{
+	auto state = job->start(piece.first);
+	size_t current = piece.first;
+	size_t last = piece.last;
+	while (current < last)
+	{
+		if (last - current > job->grain && job->queued.load(std::memory_order_relaxed) == 0)
+		{
+			size_t middle = current + (last - current) / 2;
+			job->outstanding.fetch_add(1, std::memory_order_relaxed);
+			job->pieces.emplace(range_piece{ middle, last });
+			job->queued.fetch_add(1, std::memory_order_relaxed);
+			add_task([this, job] { take_range(job); return size_t(0); });
+			last = middle;
+			continue;
+		}
+		size_t step = std::min(last, current + job->grain);
+		job->run(state, current, step);
+		current = step;
+	}
+	job->finish(state, piece.first);
+	job->outstanding.fetch_sub(1, std::memory_order_acq_rel);
+}
+
+template <typename policy_t>
+template <typename job_t>
+bool basic_thread_pool<policy_t>::take_range(const std::shared_ptr<job_t>& job)
+{
+	range_piece piece;
+	size_t ignored_id = 0;
+	if (!job->pieces.pop(piece, ignored_id)) {
+		return false;
+	}
+	job->queued.fetch_sub(1, std::memory_order_relaxed);
+	run_range(job, piece);
+	return true;
+}
+
+template <typename policy_t>
+size_t basic_thread_pool<policy_t>::get_status(size_t id)
+{
+	TaskStatus task_status;
+	bool found = false;
+	if constexpr (policy_t::task_status) {
+		found = m_task_status.load(id, task_status);
+	}
+	if (!found) {
+		std::cout << "No such task exists." << std::endl;
+		return 0;
+	}
+	if (task_status.status == TaskStatus::Status::Waiting) {
+		std::cout << "Task " << id << " is in the task queue." << std::endl;
+	}
+	else if (task_status.status == TaskStatus::Status::Working) {
+		std::cout << "Task " << id << " is being processed." << std::endl;
+		return 0;
+	}
+	else if (task_status.status == TaskStatus::Status::Failed) {
+		std::cout << "Task " << id << " threw an exception." << std::endl;
+		erase_status(id);
+	}
+	else {
+		// The result has been handed out; free the record.
+		erase_status(id);
+	}
+	return task_status.result;
+
+}
+
+template <typename policy_t>
+void basic_thread_pool<policy_t>::set_status_retention(const size_t task_count)
+{
+	write_lock _(m_rw_lock);
+	if (m_initialized)
+	{
+		return;
+	}
+	if constexpr (policy_t::task_status)
+	{
+		m_task_status.resize(task_count);
+	}
+}
+
+// Lets each worker take up to max_batch tasks per queue lock, scaled down to
+// its share of the current queue length. 1 (the default) pops one at a time.
+template <typename policy_t>
+void basic_thread_pool<policy_t>::set_batch_dequeue(const size_t max_batch)
+{
+	write_lock _(m_rw_lock);
+	if (m_initialized)
+	{
+		return;
+	}
+	m_max_batch = std::max<size_t>(max_batch, 1);
+}
+
+template <typename policy_t>
+void basic_thread_pool<policy_t>::set_elastic_policy(const elastic_policy& policy)
+{
+	write_lock _(m_rw_lock);
+	if (m_initialized)
+	{
+		return;
+	}
+	m_elastic = policy;
+}
+
+// handler gets the id and exception of every task that throws and has no
+// future to take the exception, i.e. was not added with submit(). It runs on
+// the worker, which then goes on with the next task, and must not throw.
+// Without one such exceptions are only counted in stats().tasks_failed.
+template <typename policy_t>
+void basic_thread_pool<policy_t>::set_error_handler(std::function<void(size_t, std::exception_ptr)> handler)
+{
+	write_lock _(m_rw_lock);
+	if (m_initialized)
+	{
+		return;
+	}
+	m_error_handler = std::move(handler);
+}
+
+template <typename policy_t>
+void basic_thread_pool<policy_t>::set_backpressure(const backpressure_policy& policy)
+{
+	write_lock _(m_rw_lock);
+	if (m_initialized)
+	{
+		return;
+	}
+	m_backpressure = policy;
+}
+
+template <typename policy_t>
+void basic_thread_pool<policy_t>::set_idle_policy(const idle_policy& policy)
+{
+	write_lock _(m_rw_lock);
+	if (m_initialized)
+	{
+		return;
+	}
+	m_idle = policy;
+}
+
+// A queued task is promoted by one priority level for every step tasks
+// submitted after it.
+template <typename policy_t>
+void basic_thread_pool<policy_t>::set_priority_aging(const size_t step)
+{
+	m_tasks.set_aging_step(step);
+}
+
+// Calls sink with a stats() snapshot every interval while the pool runs, and
+// once more after the workers have stopped. The sink runs on its own thread.
+template <typename policy_t>
+void basic_thread_pool<policy_t>::set_metrics_export(const std::chrono::milliseconds interval, std::function<void(const pool_stats&)> sink)
+{
+	write_lock _(m_rw_lock);
+	if (m_initialized)
+	{
+		return;
+	}
+	m_export_interval = interval;
+	m_export_sink = std::move(sink);
+}
+
+template <typename policy_t>
+pool_stats basic_thread_pool<policy_t>::stats() const
+{
+	read_lock _(m_rw_lock);
+	return collect_stats();
+}
+
+// Reads the counters without stopping the workers, so a snapshot taken while
+// tasks run may be a few increments out of step between fields.
+template <typename policy_t>
+pool_stats basic_thread_pool<policy_t>::collect_stats() const
+{
+	pool_stats stats;
+	stats.tasks_submitted = m_tasks.task_count();
+	stats.tasks_pending = m_pending_tasks.load();
+	stats.tasks_rejected = m_tasks_rejected.load();
+	stats.tasks_dropped = m_tasks_dropped.load();
+	stats.queue_wait_by_priority.resize(task_priority_count);
+	uint64_t queue_length_sum = 0;
+	for (const std::unique_ptr<worker_metrics>& metrics : m_worker_metrics)
+	{
+		stats.tasks_failed += metrics->tasks_failed.load();
+		uint64_t executed = metrics->tasks_executed.load();
+		stats.tasks_per_worker.push_back(executed);
+		stats.tasks_executed += executed;
+		queue_length_sum += metrics->queue_length_sum.load();
+		metrics->queue_wait.merge_into(stats.queue_wait);
+		metrics->execution.merge_into(stats.execution);
+		metrics->end_to_end.merge_into(stats.end_to_end);
+		for (size_t level = 0; level < task_priority_count; level++)
+		{
+			metrics->queue_wait_by_priority[level].merge_into(stats.queue_wait_by_priority[level]);
+		}
+	}
+	if (stats.tasks_executed != 0)
+	{
+		stats.average_queue_length = double(queue_length_sum) / double(stats.tasks_executed);
+	}
+	return stats;
+}
+
+template <typename policy_t>
+void basic_thread_pool<policy_t>::export_routine()
+{
+	std::unique_lock<std::mutex> lock(m_export_mutex);
+	while (!m_export_signal.wait_for(lock, m_export_interval, [this] { return m_export_stop; }))
+	{
+		lock.unlock();
+		m_export_sink(collect_stats());
+		lock.lock();
+	}
+}
+
+// Called once the workers are joined.
+template <typename policy_t>
+void basic_thread_pool<policy_t>::stop_export()
+{
+	if (!m_exporter.joinable())
+	{
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lock(m_export_mutex);
+		m_export_stop = true;
+	}
+	m_export_signal.notify_one();
+	m_exporter.join();
+	m_export_sink(collect_stats());
+}
+
+// Writes a Chrome trace of every task's queue, start and end times to path
+// while the pool runs; an empty path turns tracing off.
+template <typename policy_t>
+void basic_thread_pool<policy_t>::set_trace_file(const std::string& path)
+{
+	write_lock _(m_rw_lock);
+	if (m_initialized)
+	{
+		return;
+	}
+	m_trace_path = path;
+}
+
+template <typename policy_t>
+void basic_thread_pool<policy_t>::terminate()
+{
+	std::lock_guard<std::mutex> shutdown(m_shutdown_lock);
+	if (debug_enabled()) {
+		m_print_lock.lock();
+		printf("TRM: Terminate called.\n");
+		m_print_lock.unlock();
+	}
+	{
+		write_lock _(m_rw_lock);
+		if (!m_initialized)
+		{
+			if (debug_enabled()) {
+				debug_terminate();
+			}
+			m_workers.clear();
+			m_terminated = false;
+			return;
+		}
+		// Already set if drain() or shutdown_async() ran out of time.
+		if (debug_enabled()) {
+			m_print_lock.lock();
+			printf("TRM: Waiting for tasks to finish.\n");
+			m_print_lock.unlock();
+		}
+		m_terminated = true;
+		wake_blocked_producers();
+	}
+	finish_termination();
+}
+
+// Running tasks still finish; every task no worker has started is handed
+// back instead of being destroyed.
+template <typename policy_t>
+std::vector<unstarted_task> basic_thread_pool<policy_t>::terminate_now()
+{
+	std::lock_guard<std::mutex> shutdown(m_shutdown_lock);
+	if (debug_enabled()) {
+		m_print_lock.lock();
+		printf("TRM: Urgent termination called.\n");
+		printf("TRM: Clearing the task queue.\n");
+		m_print_lock.unlock();
+	}
+	{
+		write_lock _(m_rw_lock);
+		if (!m_initialized)
+		{
+			m_workers.clear();
+			m_terminated = false;
+			return {};
+		}
+		if (debug_enabled()) {
+			m_print_lock.lock();
+			printf("TRM: Waiting for tasks to finish.\n");
+			m_print_lock.unlock();
+		}
+		m_terminated = true;
+		wake_blocked_producers();
+	}
+	std::vector<unstarted_task> unstarted = take_queued();
+	finish_termination();
+	return unstarted;
+}
+
+// Stops taking tasks and lets the workers run the queue down for at most
+// timeout. If they finish, the pool is terminated as by terminate(); if not,
+// the tasks still queued are taken back and returned, and the pool is left to
+// the running ones until terminate() or the destructor joins it. Must not be
+// called from one of the pool's workers.
+template <typename policy_t>
+drain_result basic_thread_pool<policy_t>::drain(const std::chrono::milliseconds timeout)
+{
+	std::lock_guard<std::mutex> shutdown(m_shutdown_lock);
+	drain_result result;
+	{
+		write_lock _(m_rw_lock);
+		if (!m_initialized)
+		{
+			result.completed = true;
+			return result;
+		}
+		m_terminated = true;
+		wake_blocked_producers();
+	}
+	// Delayed tasks not yet due are handed back rather than waited for.
+	take_timers(result.unstarted);
+	if (debug_enabled()) {
+		m_print_lock.lock();
+		printf("TRM: Draining for up to %lld ms.\n", (long long)timeout.count());
+		m_print_lock.unlock();
+	}
+	stop_scaling();
+	wake_all_workers();
+	{
+		std::unique_lock<std::mutex> lock(m_exit_mutex);
+		result.completed = m_exit_signal.wait_for(lock, timeout, [this] { return m_active_workers.load() == 0; });
+	}
+	if (result.completed)
+	{
+		finish_termination();
+		return result;
+	}
+	std::vector<unstarted_task> queued = take_queued();
+	std::move(queued.begin(), queued.end(), std::back_inserter(result.unstarted));
+	result.busy_workers = m_active_workers.load();
+	if (debug_enabled()) {
+		m_print_lock.lock();
+		printf("TRM: Drain timed out with %zu tasks queued and %zu workers busy.\n", result.unstarted.size(), result.busy_workers);
+		m_print_lock.unlock();
+	}
+	return result;
+}
+
+// The pool stops taking tasks before this returns; the drain and the join
+// after it run on a background thread.
+template <typename policy_t>
+shutdown_handle basic_thread_pool<policy_t>::shutdown_async(const std::chrono::milliseconds timeout)
+{
+	{
+		write_lock _(m_rw_lock);
+		if (m_initialized)
+		{
+			m_terminated = true;
+			wake_blocked_producers();
+		}
+	}
+	if (m_shutdown_thread.joinable())
+	{
+		m_shutdown_thread.join();
+	}
+	task_promise<drain_result> drained;
+	task_promise<void> stopped;
+	shutdown_handle handle{ drained.get_future(), stopped.get_future() };
+	m_shutdown_thread = std::thread([this, timeout, drained = std::move(drained), stopped = std::move(stopped)]() mutable {
+		drained.set_value(drain(timeout));
+		terminate();
+		stopped.set_value();
+	});
+	return handle;
+}
+
+// Empties every queue of tasks no worker has started: the shared queue, the
+// workers' deques, the domain queues and the timer wheel. Their status
+// records go too.
+template <typename policy_t>
+std::vector<unstarted_task> basic_thread_pool<policy_t>::take_queued()
+{
+	std::vector<unstarted_task> taken;
+	queued_task task;
+	size_t task_id = 0;
+	{
+		write_lock _(m_rw_lock);
+		while (m_tasks.pop(task, task_id))
+		{
+			taken.push_back(unstarted_task{ task_id, task.priority, std::move(task.task) });
+		}
+	}
+	stealing_task* stolen = nullptr;
+	for (std::unique_ptr<worker_state>& state : m_worker_states)
+	{
+		while (state->deque.steal(stolen))
+		{
+			taken.push_back(unstarted_task{ stolen->id, stolen->task.priority, std::move(stolen->task.task) });
+			delete stolen;
+		}
+	}
+	size_t ignored_id = 0;
+	for (std::unique_ptr<scheduler_domain>& domain : m_domains)
+	{
+		while (domain->tasks.pop(stolen, ignored_id))
+		{
+			taken.push_back(unstarted_task{ stolen->id, stolen->task.priority, std::move(stolen->task.task) });
+			delete stolen;
+		}
+	}
+	for (unstarted_task& entry : taken)
+	{
+		release_pending(1);
+		erase_status(entry.id);
+	}
+	take_timers(taken);
+	notify_watermarks();
+	return taken;
+}
+
+// Joins the workers of a pool already marked terminated and resets it so it
+// can be initialized again. Caller holds m_shutdown_lock.
+template <typename policy_t>
+void basic_thread_pool<policy_t>::finish_termination()
+{
+	stop_scaling();
+	wake_all_workers();
+	for (std::thread& worker : m_workers)
+	{
+		if (worker.joinable())
+		{
+			worker.join();
+		}
+	}
+	close_timers();
+	stop_export();
+	if (tracing()) {
+		m_trace->stop();
+	}
+	if (debug_enabled()) {
+		debug_terminate();
+	}
+	discard_queued_tasks();
+	write_lock _(m_rw_lock);
+	m_workers.clear();
+	m_worker_states.clear();
+	m_domains.clear();
+	m_active_workers = 0;
+	m_terminated = false;
+	m_initialized = false;
+}
+
+template <typename policy_t>
+void basic_thread_pool<policy_t>::debug_terminate() {
+	pool_stats stats = collect_stats();
+	m_print_lock.lock();
+
+	printf("TRM: No tasks left, terminating.\n\n");
+	printf("====DEBUG INFO====\n");
+	printf("Tasks added: %zu\n", (size_t)stats.tasks_submitted);
+	printf("Tasks processed: %zu\n", (size_t)stats.tasks_executed);
+	static const char* class_names[task_priority_count] = { "high", "normal", "low" };
+	printf("Total queue wait time: %.3f ms\n", stats.queue_wait.sum * 1e-6);
+	printf("Average queue wait time: %.3f ms\n", stats.queue_wait.mean() * 1e-6);
+	printf("Queue wait time p50/p99/p99.9: %.3f / %.3f / %.3f ms\n", stats.queue_wait.percentile(50) * 1e-6, stats.queue_wait.percentile(99) * 1e-6, stats.queue_wait.percentile(99.9) * 1e-6);
+	printf("Execution time p50/p99/p99.9: %.3f / %.3f / %.3f ms\n", stats.execution.percentile(50) * 1e-6, stats.execution.percentile(99) * 1e-6, stats.execution.percentile(99.9) * 1e-6);
+	for (size_t level = 0; level < task_priority_count; level++)
+	{
+		const histogram_snapshot& wait = stats.queue_wait_by_priority[level];
+		if (wait.count != 0)
+		{
+			printf("Average queue wait time (%s priority): %.3f ms over %zu tasks\n", class_names[level], wait.mean() * 1e-6, (size_t)wait.count);
+		}
+	}
+	printf("Average queue length: %.3f tasks\n", stats.average_queue_length);
+
+	m_print_lock.unlock();
+}
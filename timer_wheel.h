@@ -0,0 +1,192 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// Hierarchical timing wheel. Each level has 64 slots and every slot of a level
+// spans one full turn of the level below, so scheduling is O(1) and an entry
+// is moved down at most once per level before it expires. Due times are
+// rounded up to the tick, so nothing expires early. Not synchronized: the
+// owner serializes schedule() and advance().
+template <typename payload_t>
+class timer_wheel
+{
+	using clock = std::chrono::steady_clock;
+	static constexpr size_t slot_bits = 6;
+	static constexpr size_t slot_count = size_t(1) << slot_bits;
+	static constexpr size_t level_count = 6;
+	struct entry
+	{
+		uint64_t due;
+		payload_t payload;
+	};
+public:
+	inline explicit timer_wheel(const clock::duration tick = std::chrono::milliseconds(1), const clock::time_point origin = clock::now()) : m_tick(tick), m_origin(origin) {}
+	inline bool empty() const { return m_size == 0; }
+	inline size_t size() const { return m_size; }
+	inline void schedule(const clock::time_point due, payload_t&& payload);
+	inline size_t advance(const clock::time_point now, std::vector<payload_t>& expired);
+	inline clock::time_point next_due() const;
+	inline size_t clear(std::vector<payload_t>& removed);
+private:
+	inline uint64_t tick_of(const clock::time_point time) const;
+	inline void insert(entry&& value);
+	inline void cascade(const size_t level);
+	clock::duration m_tick;
+	clock::time_point m_origin;
+	uint64_t m_current = 0;
+	size_t m_size = 0;
+	// Entries already due when scheduled.
+	std::vector<entry> m_ready;
+	std::vector<entry> m_slots[level_count][slot_count];
+};
+
+// Ticks since the origin, rounded up.
+template <typename payload_t>
+uint64_t timer_wheel<payload_t>::tick_of(const clock::time_point time) const
+{
+	if (time <= m_origin)
+	{
+		return 0;
+	}
+	return uint64_t((time - m_origin + m_tick - clock::duration(1)) / m_tick);
+}
+
+template <typename payload_t>
+void timer_wheel<payload_t>::schedule(const clock::time_point due, payload_t&& payload)
+{
+	insert(entry{ due == clock::time_point::max() ? UINT64_MAX : tick_of(due), std::move(payload) });
+	m_size++;
+}
+
+// The lowest level whose window still holds the due tick; ones past the top
+// level's window wait in its last slot and are placed again when it cascades.
+template <typename payload_t>
+void timer_wheel<payload_t>::insert(entry&& value)
+{
+	if (value.due <= m_current)
+	{
+		m_ready.push_back(std::move(value));
+		return;
+	}
+	for (size_t level = 0; level < level_count; level++)
+	{
+		size_t shift = level * slot_bits;
+		if ((value.due >> shift) - (m_current >> shift) < slot_count)
+		{
+			m_slots[level][(value.due >> shift) & (slot_count - 1)].push_back(std::move(value));
+			return;
+		}
+	}
+	size_t shift = (level_count - 1) * slot_bits;
+	m_slots[level_count - 1][((m_current >> shift) + slot_count - 1) & (slot_count - 1)].push_back(std::move(value));
+}
+
+template <typename payload_t>
+void timer_wheel<payload_t>::cascade(const size_t level)
+{
+	std::vector<entry> moved = std::move(m_slots[level][(m_current >> (level * slot_bits)) & (slot_count - 1)]);
+	m_slots[level][(m_current >> (level * slot_bits)) & (slot_count - 1)].clear();
+	for (entry& value : moved)
+	{
+		insert(std::move(value));
+	}
+}
+
+// Moves the payload of every entry due at or before now into expired and
+// returns how many there were.
+template <typename payload_t>
+size_t timer_wheel<payload_t>::advance(const clock::time_point now, std::vector<payload_t>& expired)
+{
+	size_t count = m_ready.size();
+	for (entry& value : m_ready)
+	{
+		expired.push_back(std::move(value.payload));
+	}
+	m_ready.clear();
+	// Only ticks that have fully passed expire.
+	uint64_t target = now > m_origin ? uint64_t((now - m_origin) / m_tick) : 0;
+	while (m_current < target)
+	{
+		if (m_size == count)
+		{
+			m_current = target;
+			break;
+		}
+		m_current++;
+		for (size_t level = level_count - 1; level > 0; level--)
+		{
+			if ((m_current & ((uint64_t(1) << (level * slot_bits)) - 1)) == 0)
+			{
+				cascade(level);
+			}
+		}
+		std::vector<entry>& slot = m_slots[0][m_current & (slot_count - 1)];
+		for (entry& value : slot)
+		{
+			expired.push_back(std::move(value.payload));
+		}
+		count += slot.size();
+		slot.clear();
+		// Cascading can put entries due right now on the ready list.
+		for (entry& value : m_ready)
+		{
+			expired.push_back(std::move(value.payload));
+		}
+		count += m_ready.size();
+		m_ready.clear();
+	}
+	m_size -= count;
+	return count;
+}
+
+// When the owner should call advance() next: the first occupied tick of the
+// lowest level, or the next point where a higher level cascades into it.
+template <typename payload_t>
+typename timer_wheel<payload_t>::clock::time_point timer_wheel<payload_t>::next_due() const
+{
+	if (m_size == 0)
+	{
+		return clock::time_point::max();
+	}
+	if (!m_ready.empty())
+	{
+		return m_origin + m_tick * m_current;
+	}
+	uint64_t tick = m_current + 1;
+	for (; (tick & (slot_count - 1)) != 0; tick++)
+	{
+		if (!m_slots[0][tick & (slot_count - 1)].empty())
+		{
+			break;
+		}
+	}
+	return m_origin + m_tick * tick;
+}
+
+// Removes every entry whether due or not, appending the payloads to removed.
+template <typename payload_t>
+size_t timer_wheel<payload_t>::clear(std::vector<payload_t>& removed)
+{
+	size_t count = m_size;
+	for (entry& value : m_ready)
+	{
+		removed.push_back(std::move(value.payload));
+	}
+	m_ready.clear();
+	for (auto& level : m_slots)
+	{
+		for (std::vector<entry>& slot : level)
+		{
+			for (entry& value : slot)
+			{
+				removed.push_back(std::move(value.payload));
+			}
+			slot.clear();
+		}
+	}
+	m_size = 0;
+	return count;
+}
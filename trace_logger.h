@@ -0,0 +1,261 @@
+#pragma once
+
+#include "cache_line.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+enum class trace_event : uint8_t
+{
+	queued,
+	started,
+	finished
+};
+
+struct trace_record
+{
+	uint64_t timestamp;
+	size_t task_id;
+	trace_event event;
+};
+
+// Single-producer/single-consumer ring: try_push() only from the producer,
+// try_pop() only from the consumer. Neither blocks; try_push() fails when full.
+template <typename value_type_t, size_t capacity>
+class spsc_ring
+{
+	static_assert(capacity >= 2 && (capacity & (capacity - 1)) == 0, "spsc_ring capacity must be a power of two");
+public:
+	inline bool try_push(const value_type_t& value);
+	inline bool try_pop(value_type_t& value);
+private:
+	alignas(cache_line_size) std::atomic<size_t> m_head = 0;
+	alignas(cache_line_size) std::atomic<size_t> m_tail = 0;
+	alignas(cache_line_size) value_type_t m_values[capacity];
+};
+
+// Writes task lifecycle events as Chrome trace JSON (chrome://tracing, Perfetto).
+// Every thread that records gets its own ring, so record() is a clock read and
+// a store; a background thread drains the rings to the file. Events are dropped
+// and counted, not waited for, when a ring is full.
+class trace_logger
+{
+	static constexpr size_t buffer_capacity = 1 << 13;
+	struct thread_buffer
+	{
+		spsc_ring<trace_record, buffer_capacity> ring;
+		std::atomic<uint64_t> dropped = 0;
+		uint32_t thread_id = 0;
+	};
+public:
+	inline explicit trace_logger(const std::string& path);
+	inline ~trace_logger() { stop(); }
+	inline bool is_open() const { return m_file.is_open(); }
+	inline uint64_t now() const { return timestamp(std::chrono::steady_clock::now()); }
+	inline uint64_t timestamp(const std::chrono::steady_clock::time_point time) const;
+	inline void name_current_thread(const std::string& name);
+	inline void record(const trace_event event, const size_t task_id) { record(event, task_id, now()); }
+	inline void record(const trace_event event, const size_t task_id, const uint64_t timestamp);
+	inline void stop();
+public:
+	trace_logger(const trace_logger& other) = delete;
+	trace_logger& operator=(const trace_logger& rhs) = delete;
+private:
+	inline thread_buffer* current_buffer();
+	inline void drain_routine();
+	inline void drain();
+	inline void write_line(const char* line);
+	std::ofstream m_file;
+	std::chrono::steady_clock::time_point m_origin = std::chrono::steady_clock::now();
+	const uint64_t m_serial = s_next_serial.fetch_add(1);
+	std::mutex m_buffers_lock;
+	std::vector<std::unique_ptr<thread_buffer>> m_buffers;
+	std::vector<std::pair<uint32_t, std::string>> m_thread_names;
+	size_t m_names_written = 0;
+	std::thread m_drainer;
+	std::mutex m_drain_mutex;
+	std::condition_variable m_drain_signal;
+	bool m_stop = false;
+	bool m_first_line = true;
+	inline static std::atomic<uint64_t> s_next_serial = 0;
+	// Logger serial and ring of every logger the current thread has recorded to.
+	inline static thread_local std::vector<std::pair<uint64_t, thread_buffer*>> s_thread_buffers;
+};
+
+template <typename value_type_t, size_t capacity>
+bool spsc_ring<value_type_t, capacity>::try_push(const value_type_t& value)
+{
+	size_t head = m_head.load(std::memory_order_relaxed);
+	if (head - m_tail.load(std::memory_order_acquire) == capacity)
+	{
+		return false;
+	}
+	m_values[head & (capacity - 1)] = value;
+	m_head.store(head + 1, std::memory_order_release);
+	return true;
+}
+
+template <typename value_type_t, size_t capacity>
+bool spsc_ring<value_type_t, capacity>::try_pop(value_type_t& value)
+{
+	size_t tail = m_tail.load(std::memory_order_relaxed);
+	if (tail == m_head.load(std::memory_order_acquire))
+	{
+		return false;
+	}
+	value = m_values[tail & (capacity - 1)];
+	m_tail.store(tail + 1, std::memory_order_release);
+	return true;
+}
+
+trace_logger::trace_logger(const std::string& path) : m_file(path, std::ios::out | std::ios::trunc)
+{
+	if (m_file.is_open())
+	{
+		m_file << "{\"traceEvents\":[\n";
+		m_drainer = std::thread(&trace_logger::drain_routine, this);
+	}
+}
+
+// Nanoseconds since the logger was created.
+uint64_t trace_logger::timestamp(const std::chrono::steady_clock::time_point time) const
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(time - m_origin).count();
+}
+
+void trace_logger::name_current_thread(const std::string& name)
+{
+	thread_buffer* buffer = current_buffer();
+	std::lock_guard<std::mutex> lock(m_buffers_lock);
+	m_thread_names.emplace_back(buffer->thread_id, name);
+}
+
+void trace_logger::record(const trace_event event, const size_t task_id, const uint64_t timestamp)
+{
+	thread_buffer* buffer = current_buffer();
+	if (!buffer->ring.try_push(trace_record{ timestamp, task_id, event }))
+	{
+		buffer->dropped.fetch_add(1, std::memory_order_relaxed);
+	}
+}
+
+// Flushes everything recorded so far and closes the file. Records made after
+// stop() are discarded.
+void trace_logger::stop()
+{
+	if (!m_drainer.joinable())
+	{
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lock(m_drain_mutex);
+		m_stop = true;
+	}
+	m_drain_signal.notify_one();
+	m_drainer.join();
+	drain();
+	uint64_t dropped = 0;
+	std::lock_guard<std::mutex> lock(m_buffers_lock);
+	for (std::unique_ptr<thread_buffer>& buffer : m_buffers)
+	{
+		dropped += buffer->dropped.load(std::memory_order_relaxed);
+	}
+	m_file << "\n],\"otherData\":{\"dropped_events\":" << dropped << "}}\n";
+	m_file.close();
+}
+
+trace_logger::thread_buffer* trace_logger::current_buffer()
+{
+	for (std::pair<uint64_t, thread_buffer*>& entry : s_thread_buffers)
+	{
+		if (entry.first == m_serial)
+		{
+			return entry.second;
+		}
+	}
+	thread_buffer* buffer = new thread_buffer;
+	{
+		std::lock_guard<std::mutex> lock(m_buffers_lock);
+		buffer->thread_id = static_cast<uint32_t>(m_buffers.size());
+		m_buffers.emplace_back(buffer);
+		m_thread_names.emplace_back(buffer->thread_id, "thread " + std::to_string(buffer->thread_id));
+	}
+	s_thread_buffers.emplace_back(m_serial, buffer);
+	return buffer;
+}
+
+void trace_logger::drain_routine()
+{
+	std::unique_lock<std::mutex> lock(m_drain_mutex);
+	while (!m_drain_signal.wait_for(lock, std::chrono::milliseconds(1), [this] { return m_stop; }))
+	{
+		lock.unlock();
+		drain();
+		lock.lock();
+	}
+}
+
+// Only the drain thread, or stop() after joining it, writes to the file.
+void trace_logger::drain()
+{
+	std::vector<thread_buffer*> buffers;
+	{
+		std::lock_guard<std::mutex> lock(m_buffers_lock);
+		for (; m_names_written < m_thread_names.size(); m_names_written++)
+		{
+			const std::pair<uint32_t, std::string>& name = m_thread_names[m_names_written];
+			std::string line = "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" + std::to_string(name.first) + ",\"args\":{\"name\":\"" + name.second + "\"}}";
+			write_line(line.c_str());
+		}
+		for (std::unique_ptr<thread_buffer>& buffer : m_buffers)
+		{
+			buffers.push_back(buffer.get());
+		}
+	}
+	char line[256];
+	trace_record record = {};
+	for (thread_buffer* buffer : buffers)
+	{
+		while (buffer->ring.try_pop(record))
+		{
+			double timestamp = record.timestamp * 1e-3;
+			switch (record.event)
+			{
+			case trace_event::queued:
+				// Flow start; the arrow ends where the task begins running.
+				snprintf(line, sizeof(line), "{\"name\":\"queued\",\"cat\":\"task\",\"ph\":\"s\",\"id\":%zu,\"ts\":%.3f,\"pid\":1,\"tid\":%u}", record.task_id, timestamp, buffer->thread_id);
+				write_line(line);
+				snprintf(line, sizeof(line), "{\"name\":\"queued\",\"cat\":\"task\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":1,\"tid\":%u,\"args\":{\"id\":%zu}}", timestamp, buffer->thread_id, record.task_id);
+				break;
+			case trace_event::started:
+				snprintf(line, sizeof(line), "{\"name\":\"queued\",\"cat\":\"task\",\"ph\":\"f\",\"bp\":\"e\",\"id\":%zu,\"ts\":%.3f,\"pid\":1,\"tid\":%u}", record.task_id, timestamp, buffer->thread_id);
+				write_line(line);
+				snprintf(line, sizeof(line), "{\"name\":\"task %zu\",\"cat\":\"task\",\"ph\":\"B\",\"ts\":%.3f,\"pid\":1,\"tid\":%u,\"args\":{\"id\":%zu}}", record.task_id, timestamp, buffer->thread_id, record.task_id);
+				break;
+			case trace_event::finished:
+				snprintf(line, sizeof(line), "{\"ph\":\"E\",\"ts\":%.3f,\"pid\":1,\"tid\":%u}", timestamp, buffer->thread_id);
+				break;
+			}
+			write_line(line);
+		}
+	}
+}
+
+void trace_logger::write_line(const char* line)
+{
+	if (!m_first_line)
+	{
+		m_file << ",\n";
+	}
+	m_first_line = false;
+	m_file << line;
+}
@@ -0,0 +1,158 @@
+#pragma once
+
+#include "cache_line.h"
+#include <atomic>
+#include <vector>
+#include <memory>
+#include <type_traits>
+
+// Chase-Lev work-stealing deque (Le, Pop, Cohen, Zappa Nardelli, PPoPP'13).
+// Only the owning thread may call push() and pop(); any thread may call steal().
+// pop() and steal() leave value untouched when they fail.
+template <typename value_type_t>
+class work_stealing_deque
+{
+	static_assert(std::is_trivially_copyable_v<value_type_t>, "work_stealing_deque stores values in atomics");
+
+	class circular_array
+	{
+	public:
+		inline explicit circular_array(const size_t capacity) : m_mask(capacity - 1), m_data(new std::atomic<value_type_t>[capacity]) {}
+		inline size_t capacity() const { return m_mask + 1; }
+		inline value_type_t load(const size_t index) const { return m_data[index & m_mask].load(std::memory_order_relaxed); }
+		inline void store(const size_t index, value_type_t value) { m_data[index & m_mask].store(value, std::memory_order_relaxed); }
+		inline circular_array* grow(const size_t top, const size_t bottom) const;
+	private:
+		size_t m_mask;
+		std::unique_ptr<std::atomic<value_type_t>[]> m_data;
+	};
+public:
+	inline explicit work_stealing_deque(const size_t capacity = 256);
+	inline ~work_stealing_deque() = default;
+	inline bool empty() const;
+	inline size_t size() const;
+public:
+	inline void push(value_type_t value);
+	inline bool pop(value_type_t& value);
+	inline bool steal(value_type_t& value);
+public:
+	work_stealing_deque(const work_stealing_deque& other) = delete;
+	work_stealing_deque(work_stealing_deque&& other) = delete;
+	work_stealing_deque& operator=(const work_stealing_deque& rhs) = delete;
+	work_stealing_deque& operator=(work_stealing_deque&& rhs) = delete;
+private:
+	alignas(cache_line_size) std::atomic<size_t> m_top{ 0 };
+	alignas(cache_line_size) std::atomic<size_t> m_bottom{ 0 };
+	alignas(cache_line_size) std::atomic<circular_array*> m_array;
+	// Arrays replaced by grow() stay alive until the deque is destroyed, since a
+	// concurrent thief may still be reading from them.
+	std::vector<std::unique_ptr<circular_array>> m_arrays;
+};
+
+template <typename value_type_t>
+typename work_stealing_deque<value_type_t>::circular_array* work_stealing_deque<value_type_t>::circular_array::grow(const size_t top, const size_t bottom) const
+{
+	circular_array* bigger = new circular_array(capacity() * 2);
+	for (size_t index = top; index != bottom; index++)
+	{
+		bigger->store(index, load(index));
+	}
+	return bigger;
+}
+
+template <typename value_type_t>
+work_stealing_deque<value_type_t>::work_stealing_deque(const size_t capacity)
+{
+	size_t rounded = 1;
+	while (rounded < capacity)
+	{
+		rounded <<= 1;
+	}
+	m_arrays.emplace_back(new circular_array(rounded));
+	m_array.store(m_arrays.back().get(), std::memory_order_relaxed);
+}
+
+template <typename value_type_t>
+bool work_stealing_deque<value_type_t>::empty() const
+{
+	return size() == 0;
+}
+
+template <typename value_type_t>
+size_t work_stealing_deque<value_type_t>::size() const
+{
+	size_t bottom = m_bottom.load(std::memory_order_relaxed);
+	size_t top = m_top.load(std::memory_order_relaxed);
+	return bottom > top ? bottom - top : 0;
+}
+
+template <typename value_type_t>
+void work_stealing_deque<value_type_t>::push(value_type_t value)
+{
+	size_t bottom = m_bottom.load(std::memory_order_relaxed);
+	size_t top = m_top.load(std::memory_order_acquire);
+	circular_array* array = m_array.load(std::memory_order_relaxed);
+	if (bottom - top > array->capacity() - 1)
+	{
+		array = array->grow(top, bottom);
+		m_arrays.emplace_back(array);
+		m_array.store(array, std::memory_order_release);
+	}
+	array->store(bottom, value);
+	std::atomic_thread_fence(std::memory_order_release);
+	m_bottom.store(bottom + 1, std::memory_order_relaxed);
+}
+
+template <typename value_type_t>
+bool work_stealing_deque<value_type_t>::pop(value_type_t& value)
+{
+	size_t bottom = m_bottom.load(std::memory_order_relaxed);
+	size_t top = m_top.load(std::memory_order_relaxed);
+	if (bottom == top)
+	{
+		return false;
+	}
+	bottom--;
+	circular_array* array = m_array.load(std::memory_order_relaxed);
+	m_bottom.store(bottom, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	top = m_top.load(std::memory_order_relaxed);
+	if (top > bottom)
+	{
+		m_bottom.store(bottom + 1, std::memory_order_relaxed);
+		return false;
+	}
+	value_type_t candidate = array->load(bottom);
+	if (top == bottom)
+	{
+		// Last element: race against thieves for it.
+		bool won = m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+		m_bottom.store(bottom + 1, std::memory_order_relaxed);
+		if (!won)
+		{
+			return false;
+		}
+	}
+	value = candidate;
+	return true;
+}
+
+template <typename value_type_t>
+bool work_stealing_deque<value_type_t>::steal(value_type_t& value)
+{
+	size_t top = m_top.load(std::memory_order_acquire);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	size_t bottom = m_bottom.load(std::memory_order_acquire);
+	if (top >= bottom)
+	{
+		return false;
+	}
+	circular_array* array = m_array.load(std::memory_order_consume);
+	value_type_t candidate = array->load(top);
+	if (!m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+	{
+		return false;
+	}
+	value = candidate;
+	return true;
+}